@@ -2,113 +2,10 @@
 #define LUA_API_H
 
 const char *lua_api_string =
-    "local all_state = setmetatable({}, {__mode='k'})\n"
-    "function all(t)\n"
-    "  if t == nil then\n"
-    "    return function() end\n"
-    "  end\n"
-    "  local ttype = type(t)\n"
-    "  if ttype == 'string' then\n"
-    "    local i = 0\n"
-    "    local tlen = #t\n"
-    "    return function()\n"
-    "      i = i + 1\n"
-    "      if i <= tlen then\n"
-    "        return sub(t, i, i)\n"
-    "      end\n"
-    "    end\n"
-    "  else\n"
-    "    local i = 0\n"
-    "    return function()\n"
-    "      if all_state[t] ~= nil and all_state[t] < i then\n"
-    "        i = all_state[t]\n"
-    "      end\n"
-    "      i = i + 1\n"
-    "      all_state[t] = i\n"
-    "      local v = t[i]\n"
-    "      if v == nil then\n"
-    "        all_state[t] = nil\n"
-    "      end\n"
-    "      return v\n"
-    "    end\n"
-    "  end\n"
-    "end\n"
-    "\n"
-    "function add(t, v)\n"
-    "  if type(t) == 'table' then\n"
-    "    t[#t+1] = v\n"
-    "    return v\n"
-    "  end\n"
-    "end\n"
-    "\n"
-    "function foreach(c, f)\n"
-    "  if c ~= nil then\n"
-    "    for value in all(c) do\n"
-    "      f(value)\n"
-    "    end\n"
-    "  end\n"
-    "end\n"
-    "\n"
-    "\n"
     "function mapdraw(...)\n"
     "  map(table.unpack(arg))\n"
     "end\n"
     "\n"
-    "function count(t, v)\n"
-    "  if type(t) ~= 'table' then\n"
-    "    return nil\n"
-    "  end\n"
-    "  if v == nil then\n"
-    "    return #t\n"
-    "  end\n"
-    "  local c = 0\n"
-    "  for i = 1, #t do\n"
-    "    if t[i] == v then\n"
-    "      c = c + 1\n"
-    "    end\n"
-    "  end\n"
-    "  return c\n"
-    "end\n"
-    "\n"
-    "function del(t, v)\n"
-    "  if type(t) == 'table' then\n"
-    "    local state = all_state[t]\n"
-    "    local removed_index = nil\n"
-    "    local found = false\n"
-    "    for i = 1, #t do\n"
-    "      if t[i] == v then\n"
-    "        removed_index = i\n"
-    "        found = true\n"
-    "      end\n"
-    "      if found then\n"
-    "        t[i] = t[i+1]\n"
-    "      end\n"
-    "    end\n"
-    "    if state ~= nil and removed_index ~= nil and removed_index <= state then\n"
-    "      all_state[t] = state - 1\n"
-    "    end\n"
-    "    if found then\n"
-    "      return v\n"
-    "    end\n"
-    "  end\n"
-    "end\n"
-    "\n"
-    "function deli(t, i)\n"
-    "  if type(t) == 'table' then\n"
-    "    if i == nil then\n"
-    "       i = #t\n"
-    "    end\n"
-    "    if i < 1 or i > #t then\n"
-    "      return nil\n"
-    "    end\n"
-    "    local v = t[i]\n"
-    "    for j = i, #t do\n"
-    "      t[j] = t[j+1]\n"
-    "    end\n"
-    "    return v\n"
-    "  end\n"
-    "end\n"
-    "\n"
     "function cocreate(f)\n"
     "  return coroutine.create(f)\n"
     "end\n"
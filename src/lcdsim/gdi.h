@@ -0,0 +1,33 @@
+/*
+ * gdi.h
+ *
+ *  Workstation stand-in for the DA1470x GDI display driver. The frame
+ *  buffer is a plain RGB565 array and updates complete immediately.
+ */
+
+#ifndef GDI_H
+#define GDI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GDI_DISP_RESX 240
+#define GDI_DISP_RESY 240
+
+typedef enum {
+    HW_LCDC_LAYER_0,
+} HW_LCDC_LAYER;
+
+typedef enum {
+    GDI_FORMAT_RGB565,
+} gdi_color_fmt_t;
+
+typedef void (*gdi_callback_t)(bool underflow, void *user_data);
+
+void gdi_set_layer_start(HW_LCDC_LAYER layer, int x, int y);
+void gdi_set_layer_enable(HW_LCDC_LAYER layer, bool enable);
+void gdi_set_layer_src(HW_LCDC_LAYER layer, void *buffer, int width, int height, gdi_color_fmt_t format);
+void *gdi_get_frame_buffer_addr(HW_LCDC_LAYER layer);
+void gdi_display_update_async(gdi_callback_t callback, void *user_data);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * lcdsim.c
+ *
+ *  Workstation implementation of the GDI and FreeRTOS stand-ins. Set
+ *  LCDSIM_DUMP to a file name to append every presented RGB565 frame to it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "gdi.h"
+#include "lcdsim.h"
+
+uint32_t gamepad = 0;
+
+static uint16_t m_frame_buffer[GDI_DISP_RESX * GDI_DISP_RESY];
+static FILE *m_dump = NULL;
+static bool m_dump_checked = false;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return calloc(1, sizeof(int));
+}
+
+int xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    *semaphore = 1;
+    return pdTRUE;
+}
+
+int xSemaphoreTake(SemaphoreHandle_t semaphore, unsigned ticks)
+{
+    if (!*semaphore)
+        return pdFALSE;
+    *semaphore = 0;
+    return pdTRUE;
+}
+
+void gdi_set_layer_start(HW_LCDC_LAYER layer, int x, int y)
+{
+}
+
+void gdi_set_layer_enable(HW_LCDC_LAYER layer, bool enable)
+{
+}
+
+void gdi_set_layer_src(HW_LCDC_LAYER layer, void *buffer, int width, int height, gdi_color_fmt_t format)
+{
+}
+
+void *gdi_get_frame_buffer_addr(HW_LCDC_LAYER layer)
+{
+    return m_frame_buffer;
+}
+
+void gdi_display_update_async(gdi_callback_t callback, void *user_data)
+{
+    if (!m_dump_checked) {
+        const char *path = getenv("LCDSIM_DUMP");
+        if (path)
+            m_dump = fopen(path, "wb");
+        m_dump_checked = true;
+    }
+    if (m_dump)
+        fwrite(m_frame_buffer, sizeof(m_frame_buffer), 1, m_dump);
+
+    if (callback)
+        callback(false, user_data);
+}
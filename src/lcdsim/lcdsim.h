@@ -0,0 +1,51 @@
+/*
+ * lcdsim.h
+ *
+ *  Stand-ins for the FreeRTOS, heap and controller services the device
+ *  LCD path uses, so it can be built and profiled on a workstation.
+ */
+
+#ifndef LCDSIM_H
+#define LCDSIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// FreeRTOS binary semaphore; display updates complete synchronously so it
+// never blocks.
+typedef volatile int *SemaphoreHandle_t;
+
+#define portMAX_DELAY 0xffffffffu
+#define pdTRUE 1
+#define pdFALSE 0
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+int xSemaphoreGive(SemaphoreHandle_t semaphore);
+int xSemaphoreTake(SemaphoreHandle_t semaphore, unsigned ticks);
+
+// Retro heap
+static inline void *rh_malloc(size_t size) { return malloc(size); }
+static inline void rh_free(void *ptr) { free(ptr); }
+
+// BLE controller state, always released
+#define AXIS_L_LEFT    (1 << 0)
+#define AXIS_L_RIGHT   (1 << 1)
+#define AXIS_L_UP      (1 << 2)
+#define AXIS_L_DOWN    (1 << 3)
+#define AXIS_L_TRIGGER (1 << 4)
+#define AXIS_R_LEFT    (1 << 5)
+#define AXIS_R_RIGHT   (1 << 6)
+#define AXIS_R_UP      (1 << 7)
+#define AXIS_R_DOWN    (1 << 8)
+#define AXIS_R_TRIGGER (1 << 9)
+#define DPAD_UP        (1 << 10)
+#define DPAD_RIGHT     (1 << 11)
+#define DPAD_DOWN      (1 << 12)
+#define DPAD_LEFT      (1 << 13)
+#define BUTTON_1       (1 << 14)
+#define BUTTON_2       (1 << 15)
+
+extern uint32_t gamepad;
+
+#endif
@@ -106,6 +106,24 @@ typedef struct CallInfo {
 #define isLua(ci)	((ci)->callstatus & CIST_LUA)
 
 
+/*
+** Inline cache for string-keyed accesses to upvalue tables (globals
+** through _ENV), indexed by instruction address. An entry remembers
+** where the key was found; it is only trusted while the table keeps the
+** same node array and that node still holds the key, so resizes and
+** rehashes just miss.
+*/
+#if !defined(LUAI_GCACHESIZE)
+#define LUAI_GCACHESIZE	256	/* must be a power of 2 */
+#endif
+
+typedef struct GCacheEntry {
+  const Instruction *pc;  /* instruction owning the entry */
+  Node *nodes;  /* node array the key was found in */
+  int idx;  /* index of the key's node */
+} GCacheEntry;
+
+
 /*
 ** `global state', shared by all threads of this state
 */
@@ -146,6 +164,7 @@ typedef struct global_State {
   TString *memerrmsg;  /* memory-error message */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
+  GCacheEntry gcache[LUAI_GCACHESIZE];  /* global access inline cache */
 } global_State;
 
 
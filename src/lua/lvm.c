@@ -524,6 +524,32 @@ void luaV_finishOp (lua_State *L) {
 
 
 
+/*
+** Look up short-string key in table h for the GETTABUP/SETTABUP at pc,
+** going through the inline cache (see GCacheEntry). Returns the value
+** slot, or NULL when the key is not in the table.
+*/
+static TValue *gcache_get (lua_State *L, const Instruction *pc, Table *h,
+                           TString *key) {
+  GCacheEntry *e = &G(L)->gcache[(IntPoint(pc) >> 2) & (LUAI_GCACHESIZE - 1)];
+  const TValue *res;
+  Node *n;
+  if (e->pc == pc && e->nodes == h->node && e->idx < sizenode(h)) {
+    n = gnode(h, e->idx);
+    if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key))
+      return gval(n);  /* hit */
+  }
+  res = luaH_getstr(h, key);
+  if (res == luaO_nilobject)
+    return NULL;
+  n = cast(Node *, cast(char *, res) - offsetof(Node, i_val));
+  e->pc = pc;
+  e->nodes = h->node;
+  e->idx = cast_int(n - h->node);
+  return gval(n);
+}
+
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
@@ -636,15 +662,36 @@ void luaV_execute (lua_State *L) {
         setobj2s(L, ra, cl->upvals[b]->v);
       )
       vmcase(OP_GETTABUP,
-        int b = GETARG_B(i);
-        Protect(luaV_gettable(L, cl->upvals[b]->v, RKC(i), ra));
+        TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        TValue *rc = RKC(i);
+        TValue *res;
+        if (ttistable(upval) && ttisshrstring(rc) &&
+            (res = gcache_get(L, ci->u.l.savedpc - 1, hvalue(upval),
+                              rawtsvalue(rc))) != NULL &&
+            !ttisnil(res)) {
+          setobj2s(L, ra, res);
+        }
+        else Protect(luaV_gettable(L, upval, rc, ra));
       )
       vmcase(OP_GETTABLE,
         Protect(luaV_gettable(L, RB(i), RKC(i), ra));
       )
       vmcase(OP_SETTABUP,
-        int a = GETARG_A(i);
-        Protect(luaV_settable(L, cl->upvals[a]->v, RKB(i), RKC(i)));
+        TValue *upval = cl->upvals[GETARG_A(i)]->v;
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        TValue *slot;
+        if (ttistable(upval) && ttisshrstring(rb) &&
+            (slot = gcache_get(L, ci->u.l.savedpc - 1, hvalue(upval),
+                               rawtsvalue(rb))) != NULL &&
+            !ttisnil(slot)) {
+          /* existing non-nil entry: no metamethod applies */
+          Table *h = hvalue(upval);
+          setobj2t(L, slot, rc);
+          invalidateTMcache(h);
+          luaC_barrierback(L, obj2gco(h), rc);
+        }
+        else Protect(luaV_settable(L, upval, rb, rc));
       )
       vmcase(OP_SETUPVAL,
         UpVal *uv = cl->upvals[GETARG_B(i)];
@@ -16,6 +16,36 @@
 
 const char *femto8_version = VERSION;
 
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options] [cart]\n", program);
+    printf("  -h, --help             show this help\n");
+    printf("  -p PARAM               value returned by stat(6)\n");
+    printf("  -x                     exit when the cart has no main loop callbacks\n");
+    printf("  --turbo                run as fast as possible\n");
+    printf("  --frameskip N          present every Nth frame in turbo mode\n");
+    printf("  --frames N             exit after N frames\n");
+    printf("  --bytecode-cache DIR   keep compiled carts in DIR\n");
+    printf("  --heap-limit KB        cap the Lua heap\n");
+    printf("  --heap-stats           print Lua heap statistics on exit\n");
+#ifdef SDL
+    printf("  --scale N              window size as a multiple of 128x128\n");
+    printf("  --render-thread        convert frames on a second thread\n");
+    printf("  --headless             no window, audio device or keyboard (SDL is\n");
+    printf("                         still loaded, build with PLATFORM=headless\n");
+    printf("                         for a binary without SDL)\n");
+#endif
+#ifdef HOST_FRAMEBUFFER
+    printf("  --input FILE           headless button script\n");
+    printf("  --audio-out FILE       headless audio as raw 16-bit mono\n");
+    printf("  --screenshot FILE      write the final screen as a PPM\n");
+#endif
+    printf("  --version              print the version\n");
+#ifdef HEADLESS
+    printf("This build has no SDL and always runs headless.\n");
+#endif
+}
+
 int main(int argc, char *argv[])
 {
     const char *file_name = NULL;
@@ -27,12 +57,46 @@ int main(int argc, char *argv[])
         if (strcmp(argv[i], "--version") == 0) {
             printf("v%s\n", VERSION);
             return 0;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
         } else if (strcmp(argv[i], "--skip-compat-check") == 0) {
             // Ignore for compatibiliy
         } else if (strcmp(argv[i], "-x") == 0) {
             skip_main_loop = true;
         } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
             param_string = argv[++i];
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            p8_set_turbo(true);
+        } else if (strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc) {
+            p8_set_frame_skip(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            p8_set_frame_limit(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bytecode-cache") == 0 && i + 1 < argc) {
+            p8_set_bytecode_cache(argv[++i]);
+        } else if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc) {
+            p8_set_heap_limit(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--heap-stats") == 0) {
+            p8_set_heap_stats(true);
+#ifdef SDL
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            p8_set_screen_scale(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--render-thread") == 0) {
+            p8_set_render_thread(true);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            p8_set_headless(true);
+#elif defined(HEADLESS)
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            // always on without SDL
+#endif
+#ifdef HOST_FRAMEBUFFER
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            p8_set_input_script(argv[++i]);
+        } else if (strcmp(argv[i], "--audio-out") == 0 && i + 1 < argc) {
+            p8_set_audio_sink(argv[++i]);
+        } else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc) {
+            p8_set_screenshot(argv[++i]);
+#endif
         } else if (file_name == NULL) {
             file_name = argv[i];
         }
@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <pthread.h>
@@ -152,8 +153,12 @@ int16_t m_pcm_dampen = 0;
 
 #ifdef SDL
 SDL_AudioSpec m_audio_spec;
+static bool m_audio_device = false;
 #endif
 
+// Headless sink for audio_render_frame; NULL discards the samples.
+static FILE *m_audio_sink = NULL;
+
 void audio_callback(void *userdata, uint8_t *cbuffer, int length)
 {
     render_sounds((int16_t *)cbuffer, length / sizeof(int16_t));
@@ -178,29 +183,64 @@ void audio_init()
         printf("Error on SDL_OpenAudio()\n");
     }
 
+    m_audio_device = true;
     SDL_PauseAudio(0);
 #endif
 }
 
+void audio_init_headless(const char *sink_path)
+{
+    _queue_init(&m_sound_queue);
+
+    if (sink_path) {
+        m_audio_sink = fopen(sink_path, "wb");
+        if (m_audio_sink == NULL)
+            printf("Error opening audio sink %s\n", sink_path);
+    }
+}
+
+// Mix one frame's worth of samples without an audio device.
+void audio_render_frame(unsigned fps)
+{
+    int16_t buffer[SOUND_BUFFER_SIZE];
+    int samples = SAMPLE_RATE / (fps ? fps : 30);
+
+    while (samples > 0) {
+        int length = samples < SOUND_BUFFER_SIZE ? samples : SOUND_BUFFER_SIZE;
+        render_sounds(buffer, length);
+        if (m_audio_sink)
+            fwrite(buffer, sizeof(int16_t), length, m_audio_sink);
+        samples -= length;
+    }
+}
+
 void audio_resume()
 {
 #ifdef SDL
-    SDL_PauseAudio(0);
+    if (m_audio_device)
+        SDL_PauseAudio(0);
 #endif
 }
 
 void audio_pause()
 {
 #ifdef SDL
-    SDL_PauseAudio(1);
+    if (m_audio_device)
+        SDL_PauseAudio(1);
 #endif
 }
 
 void audio_close()
 {
 #ifdef SDL
-    SDL_CloseAudio();
+    if (m_audio_device)
+        SDL_CloseAudio();
+    m_audio_device = false;
 #endif
+    if (m_audio_sink) {
+        fclose(m_audio_sink);
+        m_audio_sink = NULL;
+    }
 }
 
 void audio_sound(int32_t index, int32_t channel, uint32_t start, uint32_t end)
@@ -19,6 +19,8 @@
 #define SOUND_QUEUE_SIZE 8
 
 void audio_init();
+void audio_init_headless(const char *sink_path);
+void audio_render_frame(unsigned fps);
 void audio_resume();
 void audio_pause();
 void audio_close();
@@ -33,18 +33,26 @@
 #include "p8_dialog.h"
 #include "p8_emu.h"
 #include "p8_lua.h"
+#include "p8_lua_heap.h"
 #include "p8_lua_helper.h"
 #include "p8_overlay_helper.h"
 #include "p8_parser.h"
 #include "p8_pause_menu.h"
 
 #ifdef SDL
+#include <pthread.h>
 #include "SDL.h"
+#endif
+#ifdef HOST_FRAMEBUFFER
+#include "p8_render_helper.h"
 #else
 #include "gdi.h"
+#ifdef LCD_SIM
+#include "lcdsim.h"
+#endif
 #endif
 
-#ifdef SDL
+#ifdef HOST_FRAMEBUFFER
 // ARGB
 uint32_t m_colors[32] = {
     0x00000000, 0x001d2b53, 0x007e2553, 0x00008751, 0x00ab5236, 0x005f574f, 0x00c2c3c7, 0x00fff1e8,
@@ -66,11 +74,20 @@ static inline int color_index(uint8_t c)
 
 static int p8_init_lcd(void);
 static void p8_main_loop();
+#ifdef SDL
+static void render_thread_start(void);
+static void render_thread_stop(void);
+#endif
+#ifdef HOST_FRAMEBUFFER
+static void headless_write_screenshot(const char *path);
+#endif
 
 uint8_t *m_memory = NULL;
 uint8_t *m_cart_memory = NULL;
 
 uint8_t *m_overlay_memory = NULL;
+int m_overlay_x0 = P8_WIDTH, m_overlay_y0 = P8_HEIGHT, m_overlay_x1 = -1, m_overlay_y1 = -1;
+unsigned m_overlay_generation = 0;
 
 unsigned m_fps = 30;
 unsigned m_actual_fps = 0;
@@ -78,6 +95,16 @@ unsigned m_frames = 0;
 
 p8_clock_t m_start_time;
 
+// Fast-forward: no frame pacing, and only every m_turbo_skip-th frame is
+// presented. Speeds are multiples of real time in tenths.
+static bool m_turbo = false;
+static unsigned m_turbo_skip = 1;
+static unsigned m_turbo_speed = 10;
+static p8_clock_t m_turbo_window_start = 0;
+static unsigned m_turbo_window_frames = 0;
+static p8_clock_t m_turbo_total_time = 0;
+static unsigned m_turbo_total_frames = 0;
+
 jmp_buf jmpbuf_restart;
 static bool restart;
 
@@ -91,13 +118,39 @@ char *current_cart_dir = NULL;
 char *m_breadcrumb = NULL;
 
 static bool skip_main_loop_if_no_callbacks = false;
+static unsigned m_frame_limit = 0;
+static bool m_cart_running = false; // jmpbuf_restart is set
+static bool m_heap_stats = false;
 
 const char *m_param_string = "";
 
+#ifdef BYTECODE_CACHE_PATH
+const char *m_bytecode_cache_dir = BYTECODE_CACHE_PATH;
+#else
+const char *m_bytecode_cache_dir = NULL;
+#endif
+
 #ifdef SDL
 SDL_Surface *m_screen = NULL;
 SDL_Surface *m_output = NULL;
 SDL_PixelFormat *m_format = NULL;
+int m_screen_scale = DEFAULT_SCREEN_SCALE;
+static bool m_render_threaded = false;
+#endif
+
+#ifdef HOST_FRAMEBUFFER
+// Headless runs keep the frame in memory and never touch SDL. The HEADLESS
+// build is linked without SDL and always runs this way.
+#ifdef HEADLESS
+static const bool m_headless = true;
+#else
+static bool m_headless = false;
+#endif
+static FILE *m_input_script = NULL;
+static unsigned m_input_frames = 0;
+static uint16_t m_input_masks[PLAYER_COUNT];
+static const char *m_audio_sink_path = NULL;
+static const char *m_screenshot_path = NULL;
 #else
 SemaphoreHandle_t m_drawSemaphore;
 #endif
@@ -170,31 +223,47 @@ static void p8_sleep(unsigned ms)
 #endif
 }
 
+// Frame rate counter text; fast-forward shows the multiple of real time.
+static void p8_fps_text(char *buffer)
+{
+    if (m_turbo)
+        sprintf(buffer, "%u.%ux", m_turbo_speed / 10, m_turbo_speed % 10);
+    else
+        sprintf(buffer, "%d", (int)m_actual_fps);
+}
+
 int p8_init()
 {
     assert(!m_initialized);
 
     srand((unsigned int)time(NULL));
 
-#ifdef SDL
+    if (m_bytecode_cache_dir)
+        MKDIR(m_bytecode_cache_dir);
+
+#ifdef HOST_FRAMEBUFFER
     m_memory = (uint8_t *)malloc(MEMORY_SIZE);
     m_cart_memory = (uint8_t *)malloc(CART_MEMORY_SIZE);
     m_overlay_memory = (uint8_t *)malloc(MEMORY_SCREEN_SIZE);
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0)
-    {
-        printf("Error on SDL_Init().\n");
-        return 1;
-    }
+#ifdef SDL
+    if (!m_headless) {
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0)
+        {
+            printf("Error on SDL_Init().\n");
+            return 1;
+        }
 
-    SDL_ShowCursor(0);
-    SDL_EnableKeyRepeat(0, 0);
+        SDL_ShowCursor(0);
+        SDL_EnableKeyRepeat(0, 0);
 
-    m_screen = SDL_SetVideoMode(SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_HWSURFACE);
-    m_format = m_screen->format;
+        m_screen = SDL_SetVideoMode(SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_HWSURFACE);
+        m_format = m_screen->format;
 
-    m_output = SDL_CreateRGBSurface(0, P8_WIDTH, P8_HEIGHT, 32, m_format->Rmask, m_format->Gmask, m_format->Bmask, m_format->Amask);
+        m_output = SDL_CreateRGBSurface(0, P8_WIDTH, P8_HEIGHT, 32, m_format->Rmask, m_format->Gmask, m_format->Bmask, m_format->Amask);
 
-    SDL_WM_SetCaption("femto-8", NULL);
+        SDL_WM_SetCaption("femto-8", NULL);
+    }
+#endif
 #else
     m_drawSemaphore = xSemaphoreCreateBinary();
 
@@ -207,10 +276,15 @@ int p8_init()
 
     memset(m_memory, 0, MEMORY_SIZE);
     memset(m_cart_memory, 0, CART_MEMORY_SIZE);
-    memset(m_overlay_memory, (OVERLAY_TRANSPARENT_COLOR << 4) | OVERLAY_TRANSPARENT_COLOR, MEMORY_SCREEN_SIZE);
+    overlay_clear();
 
 #ifdef ENABLE_AUDIO
-    audio_init();
+#ifdef HOST_FRAMEBUFFER
+    if (m_headless)
+        audio_init_headless(m_audio_sink_path);
+    else
+#endif
+        audio_init();
 #endif
 
     p8_init_lcd();
@@ -228,7 +302,7 @@ int p8_init()
 
 static int p8_init_lcd(void)
 {
-#ifndef SDL
+#ifndef HOST_FRAMEBUFFER
     gdi_set_layer_start(HW_LCDC_LAYER_0, 0, 0);
 
     gdi_set_layer_enable(HW_LCDC_LAYER_0, true);
@@ -236,6 +310,9 @@ static int p8_init_lcd(void)
     uint16_t *fb = (uint16_t *)gdi_get_frame_buffer_addr(HW_LCDC_LAYER_0);
 
     gdi_set_layer_src(HW_LCDC_LAYER_0, fb, SCREEN_WIDTH, SCREEN_HEIGHT, GDI_FORMAT_RGB565);
+#elif defined(SDL)
+    if (m_render_threaded && !m_headless)
+        render_thread_start();
 #endif
 
     return 0;
@@ -252,11 +329,14 @@ static int p8_init_common(const char *file_name, const char *lua_script)
     }
 
     if (setjmp(jmpbuf_restart)) {
-        if (!restart)
+        if (!restart) {
+            m_cart_running = false;
             return 0;
+        }
     }
 
     restart = false;
+    m_cart_running = true;
 
     memcpy(m_memory, m_cart_memory, CART_MEMORY_SIZE);
 
@@ -277,6 +357,7 @@ static int p8_init_common(const char *file_name, const char *lua_script)
 
     if (!skip_main_loop_if_no_callbacks || lua_has_main_loop_callbacks())
         p8_main_loop();
+    m_cart_running = false;
     return 0;
 }
 
@@ -374,16 +455,41 @@ int p8_init_ram(uint8_t *buffer, int size)
 
 int p8_shutdown()
 {
+    if (m_turbo_total_frames > 0) {
+        unsigned ms = p8_clock_ms(m_turbo_total_time);
+        unsigned speed = ms ? (unsigned)((uint64_t)m_turbo_total_frames * 10000 / ((uint64_t)ms * m_fps)) : 0;
+        printf("Fast-forward: %u frames in %u ms (%u.%ux real time)\n", m_turbo_total_frames, ms, speed / 10, speed % 10);
+    }
+
     audio_close();
 
+    if (m_heap_stats)
+        lua_heap_print_stats();
+
     lua_shutdown_api();
 
     p8_close_cartdata();
 
+#ifdef HOST_FRAMEBUFFER
+#ifdef SDL
+    // join the worker first, it shares the render tables and buffers
+    render_thread_stop();
+#endif
+
+    if (m_screenshot_path && m_initialized)
+        headless_write_screenshot(m_screenshot_path);
+    if (m_input_script) {
+        fclose(m_input_script);
+        m_input_script = NULL;
+    }
+
 #ifdef SDL
-    SDL_FreeSurface(m_output);
-    SDL_FreeSurface(m_screen);
-    SDL_Quit();
+    if (!m_headless) {
+        SDL_FreeSurface(m_output);
+        SDL_FreeSurface(m_screen);
+        SDL_Quit();
+    }
+#endif
 
     free(m_cart_memory);
     free(m_memory);
@@ -399,7 +505,7 @@ int p8_shutdown()
     return 0;
 }
 
-#ifdef SDL
+#ifdef HOST_FRAMEBUFFER
 // Map output pixel (ox, oy) to source framebuffer pixel (sx, sy) based on
 // the screen transform mode at 0x5f2c.
 static void screen_transform_pixel(uint8_t mode, int ox, int oy, int *sx, int *sy)
@@ -449,322 +555,788 @@ static void screen_transform_pixel(uint8_t mode, int ox, int oy, int *sx, int *s
     }
 }
 
+// Everything the renderer reads from PICO-8 memory for one frame. It either
+// points into m_memory or, with the render thread, into a frame packet.
+typedef struct {
+    const uint8_t *screen; // screen RAM and the 32 bytes after it (mode 0x20)
+    const uint8_t *overlay;
+    uint8_t transform;
+    uint8_t hc_mode;
+    uint8_t palette[16];
+    uint8_t palette_secondary[16];
+    uint8_t line_bits[16]; // 0x5f70 per-scanline bitfield
+    int overlay_x0, overlay_y0, overlay_x1, overlay_y1;
+    unsigned overlay_generation;
+    bool expose; // the window needs a full redraw
+} render_frame_t;
+
 // Resolve palette for a framebuffer pixel given the high-color mode.
-// pix_index is the raw 4-bit pixel value, sy is the source scanline,
-// sx is the source x coordinate.
-static uint8_t high_color_resolve(uint8_t hc_mode, uint8_t pix_index, int sx, int sy)
+// pix_index is the raw 4-bit pixel value, sy is the source scanline. The
+// 5-bitplane mode (0x20) depends on x and is handled by render_source_row.
+static uint8_t high_color_resolve(const render_frame_t *frame, uint8_t pix_index, int sy)
 {
+    uint8_t hc_mode = frame->hc_mode;
+
     if (hc_mode == 0x10) {
         // Per-line palette swap: use secondary palette if bit set in bitfield
-        uint8_t bf = m_memory[0x5f70 + (sy >> 3)];
+        uint8_t bf = frame->line_bits[sy >> 3];
         if (bf & (1 << (sy & 7)))
-            return color_get(PALTYPE_SECONDARY, pix_index);
-        return color_get(PALTYPE_SCREEN, pix_index);
-    }
-    if (hc_mode == 0x20) {
-        // 5-bitplane mode: requires 0x5f2c == 1 (horizontal stretch).
-        // If the corresponding pixel in the hidden right half (sx+64) is
-        // non-zero, use secondary palette.
-        int hidden_offset = (m_memory[MEMORY_SCREEN_PHYS] << 8) + ((sx + 64) >> 1) + sy * 64;
-        uint8_t hidden_val = m_memory[hidden_offset];
-        uint8_t hidden_pix = IS_EVEN(sx + 64) ? (hidden_val & 0xF) : (hidden_val >> 4);
-        if (hidden_pix != 0)
-            return color_get(PALTYPE_SECONDARY, pix_index);
-        return color_get(PALTYPE_SCREEN, pix_index);
+            return frame->palette_secondary[pix_index & 0xf];
+        return frame->palette[pix_index & 0xf];
     }
     if ((hc_mode & 0xf0) == 0x30) {
         // Gradient fill: replace color n with per-section gradient
         uint8_t replace_color = hc_mode & 0x0f;
-        uint8_t screen_index = color_get(PALTYPE_SCREEN, pix_index);
+        uint8_t screen_index = frame->palette[pix_index & 0xf];
         if ((screen_index & 0x0f) == replace_color) {
             int section = sy >> 3;
-            uint8_t bf = m_memory[0x5f70 + (sy >> 3)];
+            uint8_t bf = frame->line_bits[sy >> 3];
             if (bf & (1 << (sy & 7)))
                 section = (section + 1) & 0x0f;
-            return color_get(PALTYPE_SECONDARY, section);
+            return frame->palette_secondary[section];
         }
         return screen_index;
     }
-    return color_get(PALTYPE_SCREEN, pix_index);
+    return frame->palette[pix_index & 0xf];
 }
 
-void p8_render()
+// Output colours for a 16 entry row palette, with a table mapping each
+// packed screen byte to its two output pixels. The last two tables are
+// kept, so the per-line palette swap does not rebuild them every row.
+static const render_table_t *render_table_get(const uint32_t *palette)
 {
-    sprintf(m_str_buffer, "%d", (int)m_actual_fps);
-    draw_simple_text(m_str_buffer, 0, 0, 1);
+    static render_table_t tables[2];
+    static bool valid[2] = {false, false};
+    static int next = 0;
 
-    uint32_t *output = m_output->pixels;
-    uint8_t transform = m_memory[MEMORY_SCREEN_TRANSFORM];
-    uint8_t hc_mode = m_memory[MEMORY_HIGH_COLOUR_MODE];
+    for (int i = 0; i < 2; i++) {
+        if (valid[i] && memcmp(tables[i].palette, palette, sizeof(tables[i].palette)) == 0)
+            return &tables[i];
+    }
 
-    for (int y = 0; y < P8_HEIGHT; y++)
-    {
-        for (int x = 0; x < P8_WIDTH; x++)
-        {
-            int sx, sy;
-            screen_transform_pixel(transform, x, y, &sx, &sy);
-            int screen_offset = (m_memory[MEMORY_SCREEN_PHYS] << 8) + (sx >> 1) + sy * 64;
-            uint8_t value = m_memory[screen_offset];
-            uint8_t pix = IS_EVEN(sx) ? value & 0xF : value >> 4;
-            uint8_t index;
-            if (hc_mode != 0)
-                index = high_color_resolve(hc_mode, pix, sx, sy);
-            else
-                index = color_get(PALTYPE_SCREEN, pix);
-            uint32_t color = m_colors[color_index(index)];
+    render_table_t *table = &tables[next];
+    valid[next] = true;
+    next ^= 1;
 
-            output[x + (y * P8_WIDTH)] = color;
-        }
+    render_table_fill(table, palette);
+    return table;
+}
+
+// Palette for source scanline sy. Every high-colour mode except 0x20 picks
+// colours per scanline, independent of x.
+static const render_table_t *render_row_table(const render_frame_t *frame, int sy)
+{
+    uint32_t palette[16];
+    for (int i = 0; i < 16; i++)
+        palette[i] = m_colors[color_index(high_color_resolve(frame, i, sy))];
+    return render_table_get(palette);
+}
+
+// Best available kernel for untransformed rows, chosen once. The kernels
+// are checked against render_row_normal by tests/render_rows_test.c.
+static render_row_fn render_row_normal_select(void)
+{
+    static render_row_fn selected = NULL;
+    if (selected)
+        return selected;
+
+    selected = render_row_normal;
+#if defined(RENDER_SSSE3)
+    if (__builtin_cpu_supports("ssse3"))
+        selected = render_row_normal_ssse3;
+#elif defined(RENDER_NEON)
+    selected = render_row_normal_neon;
+#endif
+    return selected;
+}
+
+static void render_row_stretch(uint32_t *out, const uint8_t *src, const render_table_t *table)
+{
+    for (int b = 0; b < P8_WIDTH / 4; b++) {
+        const uint32_t *pair = table->pairs[src[b]];
+        out[b * 4] = pair[0];
+        out[b * 4 + 1] = pair[0];
+        out[b * 4 + 2] = pair[1];
+        out[b * 4 + 3] = pair[1];
     }
+}
 
-    uint8_t *overlay_mem = m_overlay_memory;
+static void render_row_mirror(uint32_t *out, const uint8_t *src, const render_table_t *table)
+{
+    for (int b = 0; b < P8_WIDTH / 4; b++) {
+        const uint32_t *pair = table->pairs[src[b]];
+        out[b * 2] = pair[0];
+        out[b * 2 + 1] = pair[1];
+        out[P8_WIDTH - 1 - b * 2] = pair[0];
+        out[P8_WIDTH - 2 - b * 2] = pair[1];
+    }
+}
 
-    for (int y = 0; y < P8_HEIGHT; y++)
-    {
-        for (int x = 0; x < P8_WIDTH; x++)
-        {
-            int overlay_offset = (x >> 1) + y * 64;
-            uint8_t value = overlay_mem[overlay_offset];
-            uint8_t pixel_color = IS_EVEN(x) ? (value & 0xF) : (value >> 4);
+static void render_row_flip(uint32_t *out, const uint8_t *src, const render_table_t *table)
+{
+    for (int b = 0; b < P8_WIDTH / 2; b++) {
+        const uint32_t *pair = table->pairs[src[b]];
+        out[P8_WIDTH - 1 - b * 2] = pair[0];
+        out[P8_WIDTH - 2 - b * 2] = pair[1];
+    }
+}
 
-            if (pixel_color != OVERLAY_TRANSPARENT_COLOR)
-            {
-                uint32_t color = m_colors[color_index(pixel_color)];
-                output[x + (y * P8_WIDTH)] = color;
-            }
-        }
+// Output row y of a 90 degree rotation reads screen column sx, top to bottom
+// (or bottom to top when reverse is set).
+static void render_row_column(uint32_t *out, const uint8_t *screen, int sx, bool reverse, const render_table_t *table)
+{
+    const uint8_t *src = screen + (sx >> 1);
+    int shift = IS_EVEN(sx) ? 0 : 4;
+
+    for (int x = 0; x < P8_WIDTH; x++) {
+        int sy = reverse ? (P8_HEIGHT - 1 - x) : x;
+        out[x] = table->palette[(src[sy * 64] >> shift) & 0xf];
+    }
+}
+
+// Output colours of source scanline sy under the frame's high-colour mode.
+static void render_source_row(uint32_t *cols, const render_frame_t *frame, int sy)
+{
+    const uint8_t *row = frame->screen + sy * 64;
+
+    if (frame->hc_mode != 0x20) {
+        render_row_normal(cols, row, render_row_table(frame, sy));
+        return;
     }
 
-    SDL_Rect rect = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
-    // SDL_BlitSurface(m_output, NULL, m_screen, &rect);
-    SDL_SoftStretch(m_output, NULL, m_screen, &rect);
-    SDL_Flip(m_screen);
+    // 5-bitplane mode: a non-zero pixel 64 to the right (in the hidden half
+    // when 0x5f2c is 1) selects the secondary palette
+    uint32_t primary[16], secondary[16];
+    for (int i = 0; i < 16; i++) {
+        primary[i] = m_colors[color_index(frame->palette[i])];
+        secondary[i] = m_colors[color_index(frame->palette_secondary[i])];
+    }
+
+    for (int b = 0; b < P8_WIDTH / 2; b++) {
+        uint8_t value = row[b];
+        uint8_t hidden = row[b + 32];
+        cols[b * 2] = (hidden & 0xf) ? secondary[value & 0xf] : primary[value & 0xf];
+        cols[b * 2 + 1] = (hidden >> 4) ? secondary[value >> 4] : primary[value >> 4];
+    }
 }
-#else
 
-void draw_complete(bool underflow, void *user_data)
+// Place resolved source row colours according to a non-rotating transform.
+static void render_row_map(uint32_t *out, const uint32_t *cols, uint8_t transform)
 {
-    xSemaphoreGive(m_drawSemaphore);
+    switch (transform) {
+    case 1: case 3:
+        for (int x = 0; x < P8_WIDTH; x++)
+            out[x] = cols[x >> 1];
+        break;
+    case 5: case 7:
+        for (int x = 0; x < P8_WIDTH / 2; x++) {
+            out[x] = cols[x];
+            out[P8_WIDTH - 1 - x] = cols[x];
+        }
+        break;
+    case 129: case 131: case 134:
+        for (int x = 0; x < P8_WIDTH; x++)
+            out[x] = cols[P8_WIDTH - 1 - x];
+        break;
+    default:
+        memcpy(out, cols, P8_WIDTH * sizeof(uint32_t));
+        break;
+    }
 }
 
-void p8_render()
+// Convert the output rows flagged in rows.
+static void render_screen(uint32_t *output, const render_frame_t *frame, const bool *rows)
 {
-    if (xSemaphoreTake(m_drawSemaphore, portMAX_DELAY) != pdTRUE)
+    const uint8_t *screen = frame->screen;
+    uint8_t transform = frame->transform;
+    uint8_t hc_mode = frame->hc_mode;
+    bool rotated = (transform == 133 || transform == 135);
+
+    if (rotated && hc_mode != 0) {
+        // resolve every scanline, then read the columns
+        static uint32_t source[P8_HEIGHT][P8_WIDTH];
+        for (int sy = 0; sy < P8_HEIGHT; sy++)
+            render_source_row(source[sy], frame, sy);
+
+        for (int y = 0; y < P8_HEIGHT; y++) {
+            if (!rows[y])
+                continue;
+            uint32_t *out = output + y * P8_WIDTH;
+            for (int x = 0; x < P8_WIDTH; x++)
+                out[x] = (transform == 133) ? source[x][P8_WIDTH - 1 - y] : source[P8_HEIGHT - 1 - x][y];
+        }
         return;
+    }
 
-    sprintf(m_str_buffer, "%d", (int)m_actual_fps);
-    draw_text(m_str_buffer, 0, 0, 1);
+    if (hc_mode == 0x20) {
+        uint32_t cols[P8_WIDTH];
+        for (int y = 0; y < P8_HEIGHT; y++) {
+            if (!rows[y])
+                continue;
+            int sx, sy;
+            screen_transform_pixel(transform, 0, y, &sx, &sy);
+            render_source_row(cols, frame, sy);
+            render_row_map(output + y * P8_WIDTH, cols, transform);
+        }
+        return;
+    }
 
-    uint16_t *output = gdi_get_frame_buffer_addr(HW_LCDC_LAYER_0);
-    uint8_t *screen_mem = &m_memory[(m_memory[MEMORY_SCREEN_PHYS] << 8)];
-    uint8_t *pal = &m_memory[MEMORY_PALETTES + PALTYPE_SCREEN * 16];
+    if (rotated) {
+        const render_table_t *table = render_row_table(frame, 0);
+        for (int y = 0; y < P8_HEIGHT; y++) {
+            if (!rows[y])
+                continue;
+            if (transform == 133)
+                render_row_column(output + y * P8_WIDTH, screen, P8_WIDTH - 1 - y, false, table);
+            else
+                render_row_column(output + y * P8_WIDTH, screen, y, true, table);
+        }
+        return;
+    }
 
-    for (int y = 1; y <= 128; y++)
+    render_row_fn render_row;
+    switch (transform) {
+    case 1: case 3:
+        render_row = render_row_stretch;
+        break;
+    case 5: case 7:
+        render_row = render_row_mirror;
+        break;
+    case 129: case 131: case 134:
+        render_row = render_row_flip;
+        break;
+    default:
+        render_row = render_row_normal_select();
+        break;
+    }
+
+    for (int y = 0; y < P8_HEIGHT; y++)
     {
-        if (y & 0x7)
-        {
-            uint16_t *top = output;
-            uint16_t *bottom = output + 240;
+        if (!rows[y])
+            continue;
 
-            for (int x = 0; x < 128; x += 8)
-            {
+        int sx, sy;
+        screen_transform_pixel(transform, 0, y, &sx, &sy);
+        render_row(output + y * P8_WIDTH, screen + sy * 64, render_row_table(frame, sy));
+    }
+}
 
-                uint8_t left = (*screen_mem) & 0xF;
-                uint8_t right = (*screen_mem) >> 4;
+// Set when the window needs a full redraw
+static bool m_render_expose = false;
 
-                uint8_t index_left = pal[left];
-                uint8_t index_right = color_pal[right];
+#ifdef SDL
+// What the last presented frame was built from: the modes and palettes that
+// apply to every row, a copy of each screen row, and the overlay rows.
+typedef struct {
+    bool valid;
+    uint8_t modes[2 + 16 * 3];
+    uint8_t screen[P8_HEIGHT][P8_WIDTH / 2];
+    unsigned overlay_generation;
+    int overlay_y0, overlay_y1;
+} render_cache_t;
+
+static render_cache_t m_render_cache;
+
+// Flag the output rows that differ from the last presented frame and update
+// the cache. Returns the number of flagged rows.
+static int render_dirty_rows(const render_frame_t *frame, bool *rows)
+{
+    render_cache_t *cache = &m_render_cache;
+    uint8_t transform = frame->transform;
+    const uint8_t *screen = frame->screen;
+    uint8_t modes[sizeof(cache->modes)];
+
+    modes[0] = transform;
+    modes[1] = frame->hc_mode;
+    memcpy(modes + 2, frame->palette, 16);
+    memcpy(modes + 2 + 16, frame->palette_secondary, 16);
+    memcpy(modes + 2 + 32, frame->line_bits, 16);
+
+    bool all = !cache->valid || frame->expose || memcmp(modes, cache->modes, sizeof(modes)) != 0;
+    memcpy(cache->modes, modes, sizeof(modes));
+    cache->valid = true;
+
+    bool source[P8_HEIGHT];
+    bool any_source = false;
+    for (int y = 0; y < P8_HEIGHT; y++) {
+        source[y] = all || memcmp(cache->screen[y], screen + y * 64, 64) != 0;
+        if (source[y]) {
+            memcpy(cache->screen[y], screen + y * 64, 64);
+            any_source = true;
+        }
+    }
 
-                uint16_t c_left = m_colors[color_index(index_left)];
-                uint16_t c_right = m_colors[color_index(index_right)];
+    // the 5-bitplane mode also reads the start of the next scanline (and
+    // past the screen for the last one)
+    if (modes[1] == 0x20) {
+        for (int y = 0; y < P8_HEIGHT - 1; y++)
+            source[y] = source[y] || source[y + 1];
+        source[P8_HEIGHT - 1] = true;
+        any_source = true;
+    }
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
-                *top++ = c_right;
+    // rotated output rows are screen columns, so any change redraws all
+    if (transform == 133 || transform == 135)
+        all = all || any_source;
+
+    // an overlay change redraws the rows it covers now and covered before
+    int overlay_y0 = P8_HEIGHT, overlay_y1 = -1;
+    if (frame->overlay_generation != cache->overlay_generation) {
+        overlay_y0 = MIN(frame->overlay_y0, cache->overlay_y0);
+        overlay_y1 = MAX(frame->overlay_y1, cache->overlay_y1);
+        cache->overlay_generation = frame->overlay_generation;
+        cache->overlay_y0 = frame->overlay_y0;
+        cache->overlay_y1 = frame->overlay_y1;
+    }
 
-                *bottom++ = c_left;
-                *bottom++ = c_left;
-                *bottom++ = c_right;
-                *bottom++ = c_right;
+    int count = 0;
+    for (int y = 0; y < P8_HEIGHT; y++) {
+        int sx, sy;
+        screen_transform_pixel(transform, 0, y, &sx, &sy);
+        rows[y] = all || source[sy] || (y >= overlay_y0 && y <= overlay_y1);
+        if (rows[y])
+            count++;
+    }
+    return count;
+}
 
-                screen_mem++;
+// Nearest-neighbour integer upscale of output rows y0..y1 into the window:
+// each row is expanded once and then copied for the remaining scanlines.
+static void render_present_scaled(int y0, int y1)
+{
+    if (SDL_MUSTLOCK(m_screen) && SDL_LockSurface(m_screen) != 0)
+        return;
 
-                left = (*screen_mem) & 0xF;
-                right = (*screen_mem) >> 4;
+    int scale = m_screen_scale;
+    size_t row_bytes = SCREEN_WIDTH * sizeof(uint32_t);
+    const uint32_t *src = (const uint32_t *)m_output->pixels + y0 * P8_WIDTH;
+    uint8_t *dst = (uint8_t *)m_screen->pixels + y0 * scale * m_screen->pitch;
 
-                index_left = pal[left];
-                index_right = pal[right];
+    for (int y = y0; y <= y1; y++) {
+        uint32_t *row = (uint32_t *)dst;
 
-                c_left = m_colors[color_index(index_left)];
-                c_right = m_colors[color_index(index_right)];
+        if (scale == 1) {
+            memcpy(row, src, row_bytes);
+        } else {
+            uint32_t *out = row;
+            for (int x = 0; x < P8_WIDTH; x++) {
+                for (int i = 0; i < scale; i++)
+                    *out++ = src[x];
+            }
+        }
+        dst += m_screen->pitch;
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
-                *top++ = c_right;
+        for (int i = 1; i < scale; i++) {
+            memcpy(dst, row, row_bytes);
+            dst += m_screen->pitch;
+        }
+        src += P8_WIDTH;
+    }
 
-                *bottom++ = c_left;
-                *bottom++ = c_left;
-                *bottom++ = c_right;
-                *bottom++ = c_right;
+    if (SDL_MUSTLOCK(m_screen))
+        SDL_UnlockSurface(m_screen);
+}
 
-                screen_mem++;
+// Convert and composite the rows of frame that changed into m_output. Sets
+// y0..y1 to the rows to present; returns false when nothing changed. Makes
+// no SDL calls, so it can run on the render thread.
+static bool render_frame_convert(const render_frame_t *frame, int *y0_out, int *y1_out)
+{
+    bool rows[P8_HEIGHT];
+    if (render_dirty_rows(frame, rows) == 0)
+        return false;
 
-                left = (*screen_mem) & 0xF;
-                right = (*screen_mem) >> 4;
+    uint32_t *output = m_output->pixels;
+    render_screen(output, frame, rows);
 
-                index_left = pal[left];
-                index_right = pal[right];
+    int y0 = P8_HEIGHT, y1 = -1;
+    for (int y = 0; y < P8_HEIGHT; y++) {
+        if (rows[y]) {
+            y0 = MIN(y0, y);
+            y1 = y;
+        }
+    }
 
-                c_left = m_colors[color_index(index_left)];
-                c_right = m_colors[color_index(index_right)];
+    // composite only the overlay's bounding box
+    for (int y = MAX(y0, frame->overlay_y0); y <= MIN(y1, frame->overlay_y1); y++)
+    {
+        if (!rows[y])
+            continue;
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
-                *top++ = c_right;
+        for (int x = frame->overlay_x0; x <= frame->overlay_x1; x++)
+        {
+            int overlay_offset = (x >> 1) + y * 64;
+            uint8_t value = frame->overlay[overlay_offset];
+            uint8_t pixel_color = IS_EVEN(x) ? (value & 0xF) : (value >> 4);
 
-                *bottom++ = c_left;
-                *bottom++ = c_left;
-                *bottom++ = c_right;
-                *bottom++ = c_right;
+            if (pixel_color != OVERLAY_TRANSPARENT_COLOR)
+            {
+                uint32_t color = m_colors[color_index(pixel_color)];
+                output[x + (y * P8_WIDTH)] = color;
+            }
+        }
+    }
 
-                screen_mem++;
+    *y0_out = y0;
+    *y1_out = y1;
+    return true;
+}
 
-                left = (*screen_mem) & 0xF;
-                right = (*screen_mem) >> 4;
+// Scale output rows y0..y1 into the window and show them. Main thread only,
+// SDL 1.2 video calls are not safe from other threads.
+static void render_present(int y0, int y1)
+{
+    render_present_scaled(y0, y1);
+    SDL_UpdateRect(m_screen, 0, y0 * m_screen_scale, SCREEN_WIDTH, (y1 - y0 + 1) * m_screen_scale);
+}
 
-                index_left = pal[left];
-                index_right = pal[right];
+static void render_frame(const render_frame_t *frame)
+{
+    int y0, y1;
+    if (render_frame_convert(frame, &y0, &y1))
+        render_present(y0, y1);
+}
+#endif
 
-                c_left = m_colors[color_index(index_left)];
-                c_right = m_colors[color_index(index_right)];
+// Fill frame from the current memory state. With screen and overlay buffers
+// the pixels are copied so the frame stays valid while the cart runs on;
+// otherwise it points into memory.
+static void render_frame_capture(render_frame_t *frame, uint8_t *screen, uint8_t *overlay)
+{
+    int screen_addr = m_memory[MEMORY_SCREEN_PHYS] << 8;
+
+    frame->transform = m_memory[MEMORY_SCREEN_TRANSFORM];
+    frame->hc_mode = m_memory[MEMORY_HIGH_COLOUR_MODE];
+    memcpy(frame->palette, &m_memory[MEMORY_PALETTES + PALTYPE_SCREEN * 16], 16);
+    memcpy(frame->palette_secondary, &m_memory[MEMORY_PALETTE_SECONDARY], 16);
+    memcpy(frame->line_bits, &m_memory[0x5f70], 16);
+    frame->overlay_x0 = m_overlay_x0;
+    frame->overlay_y0 = m_overlay_y0;
+    frame->overlay_x1 = m_overlay_x1;
+    frame->overlay_y1 = m_overlay_y1;
+    frame->overlay_generation = m_overlay_generation;
+    frame->expose = m_render_expose;
+    m_render_expose = false;
+
+    if (screen) {
+        memcpy(screen, &m_memory[screen_addr], MIN(MEMORY_SCREEN_SIZE + 32, MEMORY_SIZE - screen_addr));
+        frame->screen = screen;
+    } else {
+        frame->screen = &m_memory[screen_addr];
+    }
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
+    if (overlay) {
+        // only the rows inside the bounding box are ever read
+        if (m_overlay_y0 <= m_overlay_y1)
+            memcpy(overlay + m_overlay_y0 * 64, m_overlay_memory + m_overlay_y0 * 64, (m_overlay_y1 - m_overlay_y0 + 1) * 64);
+        frame->overlay = overlay;
+    } else {
+        frame->overlay = m_overlay_memory;
+    }
+}
 
-                *bottom++ = c_left;
-                *bottom++ = c_right;
-                *bottom++ = c_right;
+#ifdef SDL
+// Optional render thread: p8_render snapshots the frame into one of two
+// packets and hands it over, so conversion overlaps with the next update. A
+// newer frame replaces one that has not been picked up yet. The worker only
+// writes m_output; the main thread presents the converted rows, and the
+// worker waits for that before it converts the next frame.
+typedef struct {
+    render_frame_t frame;
+    uint8_t screen[MEMORY_SCREEN_SIZE + 32];
+    uint8_t overlay[MEMORY_SCREEN_SIZE];
+} render_packet_t;
+
+static render_packet_t m_render_packets[2];
+static render_packet_t *m_render_pending = NULL;
+static render_packet_t *m_render_busy = NULL;
+static int m_render_ready_y0 = P8_HEIGHT, m_render_ready_y1 = -1;
+static bool m_render_stop = false;
+static bool m_render_thread_running = false;
+static pthread_t m_render_thread;
+static pthread_mutex_t m_render_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_render_cond = PTHREAD_COND_INITIALIZER;
+
+static void *render_thread_main(void *arg)
+{
+    for (;;) {
+        pthread_mutex_lock(&m_render_mutex);
+        while (!m_render_stop && (m_render_pending == NULL || m_render_ready_y1 >= 0))
+            pthread_cond_wait(&m_render_cond, &m_render_mutex);
+        if (m_render_stop) {
+            pthread_mutex_unlock(&m_render_mutex);
+            break;
+        }
+        m_render_busy = m_render_pending;
+        m_render_pending = NULL;
+        pthread_mutex_unlock(&m_render_mutex);
 
-                screen_mem++;
-            }
+        int y0, y1;
+        bool converted = render_frame_convert(&m_render_busy->frame, &y0, &y1);
 
-            output += 480;
+        pthread_mutex_lock(&m_render_mutex);
+        if (converted) {
+            m_render_ready_y0 = y0;
+            m_render_ready_y1 = y1;
         }
-        else
-        {
-            uint16_t *top = output;
-
-            for (int x = 0; x < 128; x += 8)
-            {
+        m_render_busy = NULL;
+        pthread_cond_broadcast(&m_render_cond);
+        pthread_mutex_unlock(&m_render_mutex);
+    }
+    return NULL;
+}
 
-                uint8_t left = (*screen_mem) & 0xF;
-                uint8_t right = (*screen_mem) >> 4;
+static void render_thread_start(void)
+{
+    m_render_stop = false;
+    if (pthread_create(&m_render_thread, NULL, render_thread_main, NULL) == 0)
+        m_render_thread_running = true;
+}
 
-                uint8_t index_left = pal[left];
-                uint8_t index_right = pal[right];
+static void render_thread_stop(void)
+{
+    if (!m_render_thread_running)
+        return;
 
-                uint16_t c_left = m_colors[color_index(index_left)];
-                uint16_t c_right = m_colors[color_index(index_right)];
+    pthread_mutex_lock(&m_render_mutex);
+    m_render_stop = true;
+    pthread_cond_broadcast(&m_render_cond);
+    pthread_mutex_unlock(&m_render_mutex);
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
-                *top++ = c_right;
+    pthread_join(m_render_thread, NULL);
+    m_render_thread_running = false;
+    m_render_pending = NULL;
+    m_render_ready_y0 = P8_HEIGHT;
+    m_render_ready_y1 = -1;
+}
 
-                screen_mem++;
+// Present the rows the worker has converted, if any. The worker leaves
+// m_output alone until the rows are cleared again.
+static void render_thread_present(void)
+{
+    if (!m_render_thread_running)
+        return;
 
-                left = (*screen_mem) & 0xF;
-                right = (*screen_mem) >> 4;
+    pthread_mutex_lock(&m_render_mutex);
+    int y0 = m_render_ready_y0, y1 = m_render_ready_y1;
+    pthread_mutex_unlock(&m_render_mutex);
+    if (y1 < 0)
+        return;
 
-                index_left = pal[left];
-                index_right = pal[right];
+    render_present(y0, y1);
 
-                c_left = m_colors[color_index(index_left)];
-                c_right = m_colors[color_index(index_right)];
+    pthread_mutex_lock(&m_render_mutex);
+    m_render_ready_y0 = P8_HEIGHT;
+    m_render_ready_y1 = -1;
+    pthread_cond_broadcast(&m_render_cond);
+    pthread_mutex_unlock(&m_render_mutex);
+}
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
-                *top++ = c_right;
+static void render_thread_submit(void)
+{
+    pthread_mutex_lock(&m_render_mutex);
+    // wait while one packet is queued and the other is being converted
+    while (m_render_pending != NULL && m_render_busy != NULL)
+        pthread_cond_wait(&m_render_cond, &m_render_mutex);
+    render_packet_t *packet = &m_render_packets[0];
+    if (packet == m_render_pending || packet == m_render_busy)
+        packet = &m_render_packets[1];
+    render_packet_t *dropped = m_render_pending;
+    pthread_mutex_unlock(&m_render_mutex);
+
+    render_frame_capture(&packet->frame, packet->screen, packet->overlay);
+
+    pthread_mutex_lock(&m_render_mutex);
+    // a frame that was never presented may still owe a full redraw
+    if (dropped != NULL && m_render_pending == dropped)
+        packet->frame.expose = packet->frame.expose || dropped->frame.expose;
+    m_render_pending = packet;
+    pthread_cond_broadcast(&m_render_cond);
+    pthread_mutex_unlock(&m_render_mutex);
+}
+#endif
 
-                screen_mem++;
+// Write the screen, palette applied, as a binary PPM.
+static void headless_write_screenshot(const char *path)
+{
+    static uint32_t pixels[P8_WIDTH * P8_HEIGHT];
+    bool rows[P8_HEIGHT];
+    render_frame_t frame;
 
-                left = (*screen_mem) & 0xF;
-                right = (*screen_mem) >> 4;
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Error writing screenshot %s\n", path);
+        return;
+    }
 
-                index_left = pal[left];
-                index_right = pal[right];
+    for (int y = 0; y < P8_HEIGHT; y++)
+        rows[y] = true;
+    render_frame_capture(&frame, NULL, NULL);
+    render_screen(pixels, &frame, rows);
+
+    fprintf(file, "P6\n%d %d\n255\n", P8_WIDTH, P8_HEIGHT);
+    for (int i = 0; i < P8_WIDTH * P8_HEIGHT; i++) {
+        uint8_t rgb[3] = { (pixels[i] >> 16) & 0xff, (pixels[i] >> 8) & 0xff, pixels[i] & 0xff };
+        fwrite(rgb, 1, 3, file);
+    }
+    fclose(file);
+}
 
-                c_left = m_colors[color_index(index_left)];
-                c_right = m_colors[color_index(index_right)];
+// Each line of the input script is "<frames> <p0 mask> [<p1 mask>]" with hex
+// button masks held for that many frames; '#' starts a comment. Without a
+// script, or past its end, no buttons are held.
+static void headless_update_input(void)
+{
+    char line[128];
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
-                *top++ = c_right;
+    while (m_input_frames == 0) {
+        memset(m_input_masks, 0, sizeof(m_input_masks));
+        if (m_input_script == NULL || fgets(line, sizeof(line), m_input_script) == NULL)
+            break;
+        if (line[0] == '#')
+            continue;
+        unsigned frames, p0 = 0, p1 = 0;
+        if (sscanf(line, "%u %x %x", &frames, &p0, &p1) < 1)
+            continue;
+        m_input_frames = frames;
+        m_input_masks[0] = p0;
+        m_input_masks[1] = p1;
+    }
+    if (m_input_frames > 0)
+        m_input_frames--;
 
-                screen_mem++;
+    for (unsigned p = 0; p < PLAYER_COUNT; ++p)
+        m_buttons[p] = m_input_masks[p];
+}
 
-                left = (*screen_mem) & 0xF;
-                right = (*screen_mem) >> 4;
+void p8_render()
+{
+    p8_fps_text(m_str_buffer);
+    draw_simple_text(m_str_buffer, 0, 0, 1);
 
-                index_left = pal[left];
-                index_right = pal[right];
+#ifdef SDL
+    if (m_headless)
+        return;
 
-                c_left = m_colors[color_index(index_left)];
-                c_right = m_colors[color_index(index_right)];
+    if (m_render_thread_running) {
+        render_thread_present();
+        render_thread_submit();
+    } else {
+        render_frame_t frame;
+        render_frame_capture(&frame, NULL, NULL);
+        render_frame(&frame);
+    }
+#endif
+}
+#else
 
-                *top++ = c_left;
-                *top++ = c_left;
-                *top++ = c_right;
+void draw_complete(bool underflow, void *user_data)
+{
+    xSemaphoreGive(m_drawSemaphore);
+}
 
-                screen_mem++;
-            }
+// First output pixel and pixel count of source column or row s in the
+// 128 to 240 downscale
+static inline int rgb565_start(int s)
+{
+    return (s >> 3) * 15 + (s & 7) * 2;
+}
 
-            output += 240;
-        }
-    }
+static inline int rgb565_span(int s)
+{
+    return (s & 7) == 7 ? 1 : 2;
+}
 
-    output = gdi_get_frame_buffer_addr(HW_LCDC_LAYER_0);
+// Composite the overlay's bounding box over the converted screen
+static void render_rgb565_overlay(uint16_t *output)
+{
+    // nothing to composite while the overlay is empty
+    if (m_overlay_x0 > m_overlay_x1)
+        return;
 
-    for (int y = 1; y <= P8_HEIGHT; y++)
+    for (int y = m_overlay_y0; y <= m_overlay_y1; y++)
     {
-        if (y & 0x7)
+        uint16_t *top = output + rgb565_start(y) * SCREEN_WIDTH;
+        uint16_t *bottom = rgb565_span(y) == 2 ? top + SCREEN_WIDTH : NULL;
+
+        for (int x = m_overlay_x0; x <= m_overlay_x1; x++)
         {
-            uint16_t *top = output;
+            uint8_t value = m_overlay_memory[(x >> 1) + y * 64];
+            uint8_t pixel_color = IS_EVEN(x) ? (value & 0xF) : (value >> 4);
 
-            for (int x = 0; x < 128; x += 2)
-            {
-                int overlay_offset = (x >> 1) + (y - 1) * 64;
-                uint8_t value = m_overlay_memory[overlay_offset];
-                uint8_t left = value & 0xF;
-                uint8_t right = value >> 4;
-
-                if (left != OVERLAY_TRANSPARENT_COLOR)
-                {
-                    uint16_t c_left = m_colors[color_index(left)];
-                    *top = c_left;
-                    *(top + 1) = c_left;
-                }
-                top += 2;
+            if (pixel_color == OVERLAY_TRANSPARENT_COLOR)
+                continue;
 
-                if (right != OVERLAY_TRANSPARENT_COLOR)
-                {
-                    uint16_t c_right = m_colors[color_index(right)];
-                    *top = c_right;
-                    *(top + 1) = c_right;
-                }
-                top += 2;
+            uint16_t color = m_colors[color_index(pixel_color)];
+            int ox = rgb565_start(x), span = rgb565_span(x);
+            for (int i = 0; i < span; i++) {
+                top[ox + i] = color;
+                if (bottom)
+                    bottom[ox + i] = color;
             }
+        }
+    }
+}
+
+// Convert the screen to RGB565 with a nearest-neighbour 128 to 240 downscale:
+// every 8 source pixels become 15, with the last of each group not doubled.
+// Rows follow the same pattern. output is SCREEN_WIDTH pixels wide.
+static void render_rgb565(uint16_t *output)
+{
+    uint16_t *start = output;
+    const uint8_t *screen = &m_memory[m_memory[MEMORY_SCREEN_PHYS] << 8];
+    const uint8_t *pal = &m_memory[MEMORY_PALETTES + PALTYPE_SCREEN * 16];
+    uint16_t colors[16];
+    uint16_t pairs[256][2];
+
+    for (int i = 0; i < 16; i++)
+        colors[i] = m_colors[color_index(pal[i])];
+    for (int i = 0; i < 256; i++) {
+        pairs[i][0] = colors[i & 0xf];
+        pairs[i][1] = colors[i >> 4];
+    }
 
-            output += 240;
+    for (int sy = 0; sy < P8_HEIGHT; sy++) {
+        const uint8_t *row = screen + sy * 64;
+        uint16_t *out = output;
+
+        for (int b = 0; b < 64; b += 4) {
+            const uint16_t *p0 = pairs[row[b]];
+            const uint16_t *p1 = pairs[row[b + 1]];
+            const uint16_t *p2 = pairs[row[b + 2]];
+            const uint16_t *p3 = pairs[row[b + 3]];
+
+            out[0] = out[1] = p0[0];
+            out[2] = out[3] = p0[1];
+            out[4] = out[5] = p1[0];
+            out[6] = out[7] = p1[1];
+            out[8] = out[9] = p2[0];
+            out[10] = out[11] = p2[1];
+            out[12] = out[13] = p3[0];
+            out[14] = p3[1];
+            out += 15;
+        }
+
+        output += SCREEN_WIDTH;
+        if ((sy & 7) != 7) {
+            memcpy(output, output - SCREEN_WIDTH, SCREEN_WIDTH * sizeof(uint16_t));
+            output += SCREEN_WIDTH;
         }
     }
 
+    render_rgb565_overlay(start);
+}
+
+void p8_render()
+{
+    if (xSemaphoreTake(m_drawSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+
+    p8_fps_text(m_str_buffer);
+    draw_simple_text(m_str_buffer, 0, 0, 1);
+
+    render_rgb565(gdi_get_frame_buffer_addr(HW_LCDC_LAYER_0));
+
     gdi_display_update_async(draw_complete, NULL);
 }
 #endif
@@ -775,17 +1347,22 @@ void p8_update_input()
     if (pointer_lock != m_prev_pointer_lock) {
         m_prev_pointer_lock  = pointer_lock;
 #ifdef SDL
-        SDL_WM_GrabInput(pointer_lock ? SDL_GRAB_ON : SDL_GRAB_OFF);
+        if (!m_headless)
+            SDL_WM_GrabInput(pointer_lock ? SDL_GRAB_ON : SDL_GRAB_OFF);
 #endif
     }
 
-#ifdef SDL
+#ifdef HOST_FRAMEBUFFER
     m_mouse_xrel = 0;
     m_mouse_yrel = 0;
     m_mouse_wheel = 0;
 
+    if (m_headless)
+        headless_update_input();
+
+#ifdef SDL
     SDL_Event event;
-    while (SDL_PollEvent(&event))
+    while (!m_headless && SDL_PollEvent(&event))
     {
         switch (event.type)
         {
@@ -869,6 +1446,9 @@ void p8_update_input()
             case SDLK_PAGEDOWN:
                 update_buttons(0, BUTTON_PAGE_DOWN, true);
                 break;
+            case SDLK_TAB:
+                p8_set_turbo(!m_turbo);
+                break;
             default:
                 break;
             }
@@ -922,6 +1502,9 @@ void p8_update_input()
             if (event.key.keysym.scancode < NUM_SCANCODES)
                 m_scancodes[event.key.keysym.scancode] = false;
             break;
+        case SDL_VIDEOEXPOSE:
+            m_render_expose = true;
+            break;
         case SDL_QUIT:
             p8_abort();
             break;
@@ -929,6 +1512,7 @@ void p8_update_input()
             break;
         }
     }
+#endif
 #else
     uint16_t mask = 0;
 
@@ -1027,13 +1611,60 @@ void p8_update_input()
 
 static void p8_post_flip(void)
 {
+#ifdef SDL
+    // show the frame the render thread converted during the wait
+    render_thread_present();
+#endif
     p8_flush_cartdata();
     p8_update_input();
     m_frames++;
+#if defined(HOST_FRAMEBUFFER) && defined(ENABLE_AUDIO)
+    if (m_headless)
+        audio_render_frame(m_fps);
+#endif
+    // only a running cart can be aborted; the loading icon flips come first
+    if (m_cart_running && m_frame_limit && m_frames >= m_frame_limit)
+        p8_abort();
+}
+
+static void p8_turbo_flip(void)
+{
+    p8_clock_t now = p8_clock();
+
+    if (m_start_time != 0)
+        m_turbo_total_time += p8_clock_delta(m_start_time, now);
+    m_turbo_total_frames++;
+
+    if (m_turbo_window_start == 0) {
+        m_turbo_window_start = now;
+        m_turbo_window_frames = 0;
+    } else {
+        m_turbo_window_frames++;
+        unsigned window = p8_clock_ms(p8_clock_delta(m_turbo_window_start, now));
+        if (window >= 1000) {
+            m_turbo_speed = m_turbo_window_frames * 10000 / (window * m_fps);
+            m_turbo_window_start = now;
+            m_turbo_window_frames = 0;
+        }
+    }
+
+    if (m_frames % m_turbo_skip == 0)
+        p8_render();
+
+    // carts still see their logical frame rate
+    m_actual_fps = m_fps;
+    m_start_time = p8_clock();
+
+    p8_post_flip();
 }
 
 void p8_flip()
 {
+    if (m_turbo) {
+        p8_turbo_flip();
+        return;
+    }
+
     p8_render();
 
     unsigned elapsed_time = p8_elapsed_time();
@@ -1066,6 +1697,10 @@ static void p8_main_loop()
 
         time_debt += elapsed;
 
+        // fast-forward never drops draws to catch up
+        if (m_turbo)
+            time_debt = 0;
+
         if (time_debt < target_frame_time || updates_since_last_flip >= m_fps) {
             lua_draw();
             time_debt += p8_elapsed_time() - elapsed;
@@ -1102,6 +1737,9 @@ unsigned p8_elapsed_time(void)
 void p8_pump_events(void)
 {
 #ifdef SDL
+    if (m_headless)
+        return;
+
     SDL_PumpEvents();
 
     // SDL_QUIT must be consumed and acted on immediately.
@@ -1244,6 +1882,77 @@ void p8_set_skip_main_loop_if_no_callbacks(bool skip)
     skip_main_loop_if_no_callbacks = skip;
 }
 
+void p8_set_turbo(bool turbo)
+{
+    m_turbo = turbo;
+    m_turbo_speed = 10;
+    m_turbo_window_start = 0;
+}
+
+void p8_set_frame_skip(unsigned skip)
+{
+    m_turbo_skip = skip > 0 ? skip : 1;
+}
+
+void p8_set_frame_limit(unsigned frames)
+{
+    m_frame_limit = frames;
+}
+
+void p8_set_bytecode_cache(const char *dir)
+{
+    m_bytecode_cache_dir = dir;
+}
+
+void p8_set_heap_limit(unsigned kb)
+{
+    lua_heap_set_limit((size_t)kb * 1024);
+}
+
+void p8_set_heap_stats(bool enable)
+{
+    m_heap_stats = enable;
+}
+
+#ifdef SDL
+// Window size as a multiple of the 128x128 screen; takes effect at init.
+void p8_set_screen_scale(int scale)
+{
+    m_screen_scale = scale > 0 ? scale : 1;
+}
+
+void p8_set_render_thread(bool enable)
+{
+    m_render_threaded = enable;
+}
+
+void p8_set_headless(bool headless)
+{
+    m_headless = headless;
+}
+#endif
+
+#ifdef HOST_FRAMEBUFFER
+void p8_set_input_script(const char *path)
+{
+    if (m_input_script)
+        fclose(m_input_script);
+    m_input_script = fopen(path, "r");
+    if (m_input_script == NULL)
+        printf("Error opening input script %s\n", path);
+}
+
+void p8_set_audio_sink(const char *path)
+{
+    m_audio_sink_path = path;
+}
+
+void p8_set_screenshot(const char *path)
+{
+    m_screenshot_path = path;
+}
+#endif
+
 bool p8_open_cartdata(const char *id)
 {
     if (cartdata)
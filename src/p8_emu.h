@@ -16,17 +16,31 @@
 
 #define PROGNAME "femto8"
 
-#ifdef __DA1470x__
+#if defined(__DA1470x__)
 #define OS_FREERTOS
+#elif defined(LCD_SIM)
+// Workstation build of the device LCD path, see src/lcdsim
+#elif defined(HEADLESS)
+// Server build without SDL, every run is headless, see Makefile.headless
+#define ENABLE_AUDIO
 #else
 #define SDL
 #define ENABLE_AUDIO
 #endif
 
+// The screen is converted to a 32-bit ARGB frame in memory, and the
+// headless options (input script, audio sink, screenshot) are available
+#if defined(SDL) || defined(HEADLESS)
+#define HOST_FRAMEBUFFER
+#endif
+
 #ifndef CARTDATA_PATH
 #define CARTDATA_PATH "cdata"
 #endif
 
+// Define BYTECODE_CACHE_PATH to keep compiled carts there by default
+// #define BYTECODE_CACHE_PATH "bcache"
+
 #ifndef DEFAULT_CARTS_PATH
 #define DEFAULT_CARTS_PATH "carts"
 #endif
@@ -43,12 +57,13 @@
 #define NIBBLE_SWAP(n) (((n) << 4) | ((n) >> 4))
 #define ARGB_TO_RGB565(argb) ((((argb) >> 8) & 0xF800) | (((argb) >> 5) & 0x07E0) | (((argb) >> 3) & 0x001F))
 
-#ifdef __DA1470x__
+#if defined(__DA1470x__) || defined(LCD_SIM)
 #define SCREEN_WIDTH 240
 #define SCREEN_HEIGHT 240
 #else
-#define SCREEN_WIDTH 512
-#define SCREEN_HEIGHT 512
+#define DEFAULT_SCREEN_SCALE 4
+#define SCREEN_WIDTH (P8_WIDTH * m_screen_scale)
+#define SCREEN_HEIGHT (P8_HEIGHT * m_screen_scale)
 #endif
 
 #define P8_WIDTH 128
@@ -265,6 +280,10 @@ extern unsigned char *m_cart_memory;
 extern char *m_font;
 
 extern uint8_t *m_overlay_memory;
+// Bounding box of everything drawn to the overlay since it was last cleared
+// (empty when x0 > x1), and a counter bumped on every overlay write.
+extern int m_overlay_x0, m_overlay_y0, m_overlay_x1, m_overlay_y1;
+extern unsigned m_overlay_generation;
 extern char *current_cart_dir;
 
 extern char *m_breadcrumb;
@@ -282,6 +301,7 @@ extern uint16_t m_button_first_repeat[PLAYER_COUNT];
 extern unsigned m_button_down_time[PLAYER_COUNT][BUTTON_INTERNAL_COUNT];
 #ifdef SDL
 extern uint16_t m_buttons_latch[PLAYER_COUNT];
+extern int m_screen_scale;
 #endif
 
 extern jmp_buf jmpbuf_restart;
@@ -290,6 +310,8 @@ extern bool m_load_available;
 
 extern const char *m_param_string;
 
+extern const char *m_bytecode_cache_dir;
+
 void __attribute__ ((noreturn)) p8_abort();
 void p8_close_cartdata(void);
 void p8_delayed_flush_cartdata(void);
@@ -300,6 +322,22 @@ int p8_init(void);
 int p8_init_file_with_param(const char *file_name, const char *param);
 void __attribute__ ((noreturn)) p8_load_new(const char *filename, const char *param);
 void p8_set_skip_main_loop_if_no_callbacks(bool skip);
+void p8_set_turbo(bool turbo);
+void p8_set_frame_skip(unsigned skip);
+void p8_set_frame_limit(unsigned frames);
+void p8_set_bytecode_cache(const char *dir);
+void p8_set_heap_limit(unsigned kb);
+void p8_set_heap_stats(bool enable);
+#ifdef SDL
+void p8_set_screen_scale(int scale);
+void p8_set_render_thread(bool enable);
+void p8_set_headless(bool headless);
+#endif
+#ifdef HOST_FRAMEBUFFER
+void p8_set_input_script(const char *path);
+void p8_set_audio_sink(const char *path);
+void p8_set_screenshot(const char *path);
+#endif
 int p8_init_ram(uint8_t *buffer, int size);
 bool p8_open_cartdata(const char *id);
 void p8_pump_events(void);
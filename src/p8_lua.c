@@ -34,6 +34,7 @@
 #include <time.h>
 #include <string.h>
 #include <unistd.h>
+#include "p8_lua_heap.h"
 #include "p8_lua_helper.h"
 #include "p8_print_helper.h"
 #include "pico_font.h"
@@ -564,28 +565,38 @@ int rrectfill(lua_State *L)
     r = MAX(0, MIN(r, MIN(w, h) / 2));
 
     if (invert) {
-        int cx, cy;
-        camera_get(&cx, &cy);
-        int clip_x0, clip_y0, clip_x1, clip_y1;
-        clip_get(&clip_x0, &clip_y0, &clip_x1, &clip_y1);
-        for (int y = clip_y0; y < clip_y1; y++) {
-            for (int x = clip_x0; x < clip_x1; x++) {
-                int wx = x + cx;
-                int wy = y + cy;
-                if (!point_in_round_rect(wx, wy, left, top, right, bottom, r))
-                    pixel_set(wx, wy, col, fillp, DRAWTYPE_GRAPHIC);
+        draw_state_t ds;
+        fill_style_t style;
+        draw_state_init(&ds);
+        fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+        // the clip rect minus the rounded rect: up to two spans per row
+        for (int y = ds.clip_y0; y < ds.clip_y1; y++) {
+            int inset = round_rect_row_inset(y + ds.camera_y, top, bottom, r);
+            if (inset < 0 || left + inset > right - inset) {
+                fill_span(&style, ds.clip_x0, ds.clip_x1 - 1, y);
+            } else {
+                fill_span(&style, ds.clip_x0, left + inset - ds.camera_x - 1, y);
+                fill_span(&style, right - inset - ds.camera_x + 1, ds.clip_x1 - 1, y);
             }
         }
         return 0;
     }
 
-    draw_rectfill(left, top+r, right, bottom-r, col, fillp);
-    draw_rectfill(left+r, top, right-r, top+r, col, fillp);
-    draw_rectfill(left+r, bottom-r, right-r, bottom, col, fillp);
-    draw_circfill_mask(left+r, top+r, r, col, fillp, 1 << 3 | 1 << 7);
-    draw_circfill_mask(right-r, top+r, r, col, fillp, 1 << 2 | 1 << 6);
-    draw_circfill_mask(left+r, bottom-r, r, col, fillp, 1 << 1 | 1 << 5);
-    draw_circfill_mask(right-r, bottom-r, r, col, fillp, 1 << 0 | 1 << 4);
+    draw_state_t ds;
+    fill_style_t style;
+    span_list_t spans;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+    span_list_init(&spans);
+
+    span_list_add_rect(&spans, &ds, left, top+r, right, bottom-r);
+    span_list_add_rect(&spans, &ds, left+r, top, right-r, top+r);
+    span_list_add_rect(&spans, &ds, left+r, bottom-r, right-r, bottom);
+    span_list_add_oval(&spans, &ds, left+r, top+r, r, r, 1 << 3 | 1 << 7);
+    span_list_add_oval(&spans, &ds, right-r, top+r, r, r, 1 << 2 | 1 << 6);
+    span_list_add_oval(&spans, &ds, left+r, bottom-r, r, r, 1 << 1 | 1 << 5);
+    span_list_add_oval(&spans, &ds, right-r, bottom-r, r, r, 1 << 0 | 1 << 4);
+    fill_spans(&style, &spans);
 
     return 0;
 }
@@ -663,67 +674,129 @@ int sspr(lua_State *L)
     int dh = lua_to_or_default(L, integer, 8, sh);
     bool flip_x = lua_to_or_default(L, boolean, 9, false);
     bool flip_y = lua_to_or_default(L, boolean, 10, false);
-    float scale_x = (float)dw / sw;
-    float scale_y = (float)dh / sh;
 
-    draw_scaled_sprite(sx, sy, sw, sh, dx, dy, scale_x, scale_y, flip_x, flip_y);
+    draw_scaled_sprite(sx, sy, sw, sh, dx, dy, dw, dh, flip_x, flip_y);
 
     return 0;
 }
 
-// tline( x0, y0, x1, y1, mx, my, [mdx,] [mdy])
-// tline( precision )
-int tline(lua_State *L)
+typedef struct {
+    draw_state_t ds;
+    bool map_invalid;
+    uint8_t map_start_upper;
+    uint8_t map_start_lower;
+    int map_width;
+    int offset_x;
+    int offset_y;
+    int precision;
+    uint32_t mask_x_bits;
+    uint32_t mask_y_bits;
+    int layer;
+    const uint8_t *sprite_flags;
+    bool sprite_0_opaque;
+} tline_state_t;
+
+// Palette-mapped colour of the map texel at mx_bits, my_bits, or -1 if
+// nothing is drawn for it.
+static inline int tline_sample(const tline_state_t *t, uint32_t mx_bits, uint32_t my_bits)
 {
-    if (lua_gettop(L) == 1) {
-        m_tline_precision = lua_tointeger(L, 1);
-        return 0;
+    uint32_t tmx = mx_bits & t->mask_x_bits;
+    uint32_t tmy = my_bits & t->mask_y_bits;
+
+    int tx = (tmx >> t->precision) + t->offset_x;
+    int ty = (tmy >> t->precision) + t->offset_y;
+
+    int celx = tx >> 3;
+    int cely = ty >> 3;
+    int index = 0;
+    if (!t->map_invalid && celx >= 0 && cely >= 0) {
+        uint8_t ms = (cely >= 32 && t->map_start_upper < 0x80) ? t->map_start_lower : t->map_start_upper;
+        int adj_cely = (cely >= 32 && t->map_start_upper < 0x80) ? cely - 32 : cely;
+        int address = (ms << 8) + celx + adj_cely * t->map_width;
+        if (address >= 0x1000 && address < 0x10000 &&
+            !(address >= 0x3000 && address < 0x8000))
+            index = m_memory[address];
     }
 
-    int x0 = lua_tointeger(L, 1);
-    int y0 = lua_tointeger(L, 2);
-    int x1 = lua_tointeger(L, 3);
-    int y1 = lua_tointeger(L, 4);
-    lua_Number mx = lua_tonumber(L, 5);
-    lua_Number my = lua_tonumber(L, 6);
-    lua_Number mdx = lua_to_or_default(L, number, 7, fix32_div(fix32_from_int(1), fix32_from_int(8)));
-    lua_Number mdy = lua_to_or_default(L, number, 8, fix32_from_int(0));
-    int layer = lua_to_or_default(L, integer, 9, 0);
+    if ((index == 0 && !t->sprite_0_opaque) || (t->layer != 0 && (t->layer & t->sprite_flags[index]) != t->layer))
+        return -1;
 
-    int cx, cy;
-    camera_get(&cx, &cy);
-    int clip_x0, clip_y0, clip_x1, clip_y1;
-    clip_get(&clip_x0, &clip_y0, &clip_x1, &clip_y1);
+    int spx = (index & 0xF) * 8 + (tx & 7);
+    int spy = (index >> 4) * 8 + (ty & 7);
 
-    uint8_t map_start = m_memory[MEMORY_MAP_START];
-    bool map_invalid = (map_start >= 0x10 && map_start < 0x20) ||
-                       (map_start >= 0x30 && map_start < 0x3f);
-    uint8_t map_start_upper = map_start;
-    uint8_t map_start_lower = map_start;
-    if (!map_invalid) {
-        if (map_start < 0x10 || (map_start >= 0x40 && map_start < 0x80))
-            map_start_upper = 0x20;
-        else
-            map_start_upper = map_start;
-        map_start_lower = (map_start_upper < 0x80) ? 0x10 : map_start_upper;
+    uint8_t spr = t->ds.sprites[(spx >> 1) + spy * 64];
+    uint8_t col = IS_EVEN(spx) ? spr & 0xF : spr >> 4;
+
+    uint8_t mapped = t->ds.palette[col & 0xf];
+    if ((mapped & 0xf0) != 0)
+        return -1;
+
+    return mapped;
+}
+
+// Write a clipped pixel; unmasked writes skip the 0x5f5e read/write mask.
+static inline void tline_plot(const draw_state_t *ds, int px, int py, int col, bool masked)
+{
+    if (masked) {
+        screen_pixel_write(ds, px, py, col);
+        return;
     }
-    int map_width = m_memory[MEMORY_MAP_WIDTH];
-    if (map_width == 0) map_width = 256;
 
-    int sprite_base = m_memory[MEMORY_SPRITE_PHYS] << 8;
-    int screen_base = m_memory[MEMORY_SCREEN_PHYS] << 8;
+    uint8_t *p = ds->screen + (px >> 1) + py * 64;
+    *p = IS_EVEN(px) ? (*p & 0xF0) | col : (col << 4) | (*p & 0xF);
+}
 
-    int offset_x = m_memory[MEMORY_TLINE_OFFSET_X] * 8;
-    int offset_y = m_memory[MEMORY_TLINE_OFFSET_Y] * 8;
-    int precision = m_tline_precision;
+// Walk the n pixels of a horizontal (sy == 0) or vertical (sx == 0) tline
+// starting at screen position px, py, skipping straight to the part inside
+// the clip rectangle.
+static void tline_straight(const tline_state_t *t, int px, int py, int sx, int sy, int64_t n,
+                           uint32_t mx_bits, uint32_t my_bits, uint32_t mdx_bits, uint32_t mdy_bits)
+{
+    const draw_state_t *ds = &t->ds;
+    bool masked = ds->rw_mask != 0xff;
+    int64_t first, last;
 
-    uint32_t mask_x_bits = ((uint32_t)m_memory[MEMORY_TLINE_MASK_X] << (precision + 3)) - 1;
-    uint32_t mask_y_bits = ((uint32_t)m_memory[MEMORY_TLINE_MASK_Y] << (precision + 3)) - 1;
+    if (sy == 0) {
+        if (py < ds->clip_y0 || py >= ds->clip_y1)
+            return;
+        first = sx > 0 ? ds->clip_x0 - px : px - (ds->clip_x1 - 1);
+        last = sx > 0 ? ds->clip_x1 - 1 - px : px - ds->clip_x0;
+    } else {
+        if (px < ds->clip_x0 || px >= ds->clip_x1)
+            return;
+        first = sy > 0 ? ds->clip_y0 - py : py - (ds->clip_y1 - 1);
+        last = sy > 0 ? ds->clip_y1 - 1 - py : py - ds->clip_y0;
+    }
 
-    uint32_t mx_bits = fix32_bits(mx);
-    uint32_t my_bits = fix32_bits(my);
-    uint32_t mdx_bits = fix32_bits(mdx);
-    uint32_t mdy_bits = fix32_bits(mdy);
+    first = MAX(first, 0);
+    last = MIN(last, n - 1);
+    if (first > last)
+        return;
+
+    // the texture coordinates advance on every step, clipped or not
+    mx_bits += mdx_bits * (uint32_t)first;
+    my_bits += mdy_bits * (uint32_t)first;
+    px += sx * (int)first;
+    py += sy * (int)first;
+
+    for (int64_t i = first; i <= last; i++)
+    {
+        int col = tline_sample(t, mx_bits, my_bits);
+        if (col >= 0)
+            tline_plot(ds, px, py, col, masked);
+
+        px += sx;
+        py += sy;
+        mx_bits += mdx_bits;
+        my_bits += mdy_bits;
+    }
+}
+
+static void tline_general(const tline_state_t *t, int x0, int y0, int x1, int y1,
+                          uint32_t mx_bits, uint32_t my_bits, uint32_t mdx_bits, uint32_t mdy_bits)
+{
+    const draw_state_t *ds = &t->ds;
+    bool masked = ds->rw_mask != 0xff;
 
     int dx = abs(x1 - x0);
     int sx = x0 < x1 ? 1 : -1;
@@ -731,60 +804,14 @@ int tline(lua_State *L)
     int sy = y0 < y1 ? 1 : -1;
     int err = dx + dy;
 
-    uint8_t *draw_pal = &m_memory[MEMORY_PALETTES + PALTYPE_DRAW * 16];
-    uint8_t *sprite_flags_base = &m_memory[MEMORY_SPRITEFLAGS];
-    bool sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
-    uint8_t rw_mask = m_memory[MEMORY_RW_MASK];
-
     while (true)
     {
-        uint32_t tmx = mx_bits & mask_x_bits;
-        uint32_t tmy = my_bits & mask_y_bits;
-
-        int tx = (tmx >> precision) + offset_x;
-        int ty = (tmy >> precision) + offset_y;
-
-        int celx = tx >> 3;
-        int cely = ty >> 3;
-        int index = 0;
-        if (!map_invalid && celx >= 0 && cely >= 0) {
-            uint8_t ms = (cely >= 32 && map_start_upper < 0x80) ? map_start_lower : map_start_upper;
-            int adj_cely = (cely >= 32 && map_start_upper < 0x80) ? cely - 32 : cely;
-            int address = (ms << 8) + celx + adj_cely * map_width;
-            if (address >= 0x1000 && address < 0x10000 &&
-                !(address >= 0x3000 && address < 0x8000))
-                index = m_memory[address];
-        }
-
-        if ((index != 0 || sprite_0_opaque) && (layer == 0 || ((layer & sprite_flags_base[index]) == layer))) {
-            int spx = (index & 0xF) * 8 + (tx & 7);
-            int spy = (index >> 4) * 8 + (ty & 7);
-
-            int spr_offset = sprite_base + (spx >> 1) + spy * 64;
-            uint8_t col = IS_EVEN(spx) ? m_memory[spr_offset] & 0xF : m_memory[spr_offset] >> 4;
-
-            uint8_t mapped = draw_pal[col & 0xf];
-            int px = x0 - cx;
-            int py = y0 - cy;
-            if ((mapped & 0xf0) == 0) {
-                if (px >= clip_x0 && px < clip_x1 && py >= clip_y0 && py < clip_y1) {
-                    int scr_offset = screen_base + (px >> 1) + py * 64;
-                    if (rw_mask != 0xff) {
-                        uint8_t write_mask = rw_mask & 0xf;
-                        uint8_t read_mask = (rw_mask >> 4) & 0xf;
-                        uint8_t dst = IS_EVEN(px) ? m_memory[scr_offset] & 0xf : m_memory[scr_offset] >> 4;
-                        uint8_t src = mapped & 0xf;
-                        uint8_t result = (dst & ~write_mask) | (src & write_mask & read_mask);
-                        m_memory[scr_offset] = IS_EVEN(px)
-                            ? (m_memory[scr_offset] & 0xF0) | result
-                            : (result << 4) | (m_memory[scr_offset] & 0xF);
-                    } else {
-                        m_memory[scr_offset] = IS_EVEN(px)
-                            ? (m_memory[scr_offset] & 0xF0) | (mapped & 0xF)
-                            : (mapped << 4) | (m_memory[scr_offset] & 0xF);
-                    }
-                }
-            }
+        int px = x0 - ds->camera_x;
+        int py = y0 - ds->camera_y;
+        if (px >= ds->clip_x0 && px < ds->clip_x1 && py >= ds->clip_y0 && py < ds->clip_y1) {
+            int col = tline_sample(t, mx_bits, my_bits);
+            if (col >= 0)
+                tline_plot(ds, px, py, col, masked);
         }
 
         if (x0 == x1 && y0 == y1)
@@ -807,6 +834,71 @@ int tline(lua_State *L)
         mx_bits += mdx_bits;
         my_bits += mdy_bits;
     }
+}
+
+// tline( x0, y0, x1, y1, mx, my, [mdx,] [mdy])
+// tline( precision )
+int tline(lua_State *L)
+{
+    if (lua_gettop(L) == 1) {
+        m_tline_precision = lua_tointeger(L, 1);
+        return 0;
+    }
+
+    int x0 = lua_tointeger(L, 1);
+    int y0 = lua_tointeger(L, 2);
+    int x1 = lua_tointeger(L, 3);
+    int y1 = lua_tointeger(L, 4);
+    lua_Number mx = lua_tonumber(L, 5);
+    lua_Number my = lua_tonumber(L, 6);
+    lua_Number mdx = lua_to_or_default(L, number, 7, fix32_div(fix32_from_int(1), fix32_from_int(8)));
+    lua_Number mdy = lua_to_or_default(L, number, 8, fix32_from_int(0));
+
+    tline_state_t t;
+    draw_state_init(&t.ds);
+    t.layer = lua_to_or_default(L, integer, 9, 0);
+
+    uint8_t map_start = m_memory[MEMORY_MAP_START];
+    t.map_invalid = (map_start >= 0x10 && map_start < 0x20) ||
+                    (map_start >= 0x30 && map_start < 0x3f);
+    t.map_start_upper = map_start;
+    t.map_start_lower = map_start;
+    if (!t.map_invalid) {
+        if (map_start < 0x10 || (map_start >= 0x40 && map_start < 0x80))
+            t.map_start_upper = 0x20;
+        else
+            t.map_start_upper = map_start;
+        t.map_start_lower = (t.map_start_upper < 0x80) ? 0x10 : t.map_start_upper;
+    }
+    t.map_width = m_memory[MEMORY_MAP_WIDTH];
+    if (t.map_width == 0) t.map_width = 256;
+
+    t.offset_x = m_memory[MEMORY_TLINE_OFFSET_X] * 8;
+    t.offset_y = m_memory[MEMORY_TLINE_OFFSET_Y] * 8;
+    t.precision = m_tline_precision;
+
+    t.mask_x_bits = ((uint32_t)m_memory[MEMORY_TLINE_MASK_X] << (t.precision + 3)) - 1;
+    t.mask_y_bits = ((uint32_t)m_memory[MEMORY_TLINE_MASK_Y] << (t.precision + 3)) - 1;
+
+    t.sprite_flags = &m_memory[MEMORY_SPRITEFLAGS];
+    t.sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
+
+    uint32_t mx_bits = fix32_bits(mx);
+    uint32_t my_bits = fix32_bits(my);
+    uint32_t mdx_bits = fix32_bits(mdx);
+    uint32_t mdy_bits = fix32_bits(mdy);
+
+    int px = x0 - t.ds.camera_x;
+    int py = y0 - t.ds.camera_y;
+
+    if (y0 == y1)
+        tline_straight(&t, px, py, x0 < x1 ? 1 : -1, 0, llabs((int64_t)x1 - x0) + 1,
+                       mx_bits, my_bits, mdx_bits, mdy_bits);
+    else if (x0 == x1)
+        tline_straight(&t, px, py, 0, y0 < y1 ? 1 : -1, llabs((int64_t)y1 - y0) + 1,
+                       mx_bits, my_bits, mdx_bits, mdy_bits);
+    else
+        tline_general(&t, x0, y0, x1, y1, mx_bits, my_bits, mdx_bits, mdy_bits);
 
     return 0;
 }
@@ -815,11 +907,307 @@ int tline(lua_State *L)
 // *** Tables ***
 // ****************************************************************
 
+// The index each table is being walked at by all(), so that del() during
+// the loop can step it back. Kept in a weak-keyed table in the registry,
+// like the Lua version's all_state, so nested and abandoned walks never
+// lose or share an entry.
+static const char m_all_state_key = 0;
+
+static void all_state_create(lua_State *L)
+{
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &m_all_state_key);
+}
+
+// Push the walk index of the table at idx, nil if it is not being walked.
+static void all_state_get(lua_State *L, int idx)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &m_all_state_key);
+    lua_pushvalue(L, idx);
+    lua_rawget(L, -2);
+    lua_remove(L, -2);
+}
+
+// Set the walk index of the table at idx, a negative index removes the
+// entry. del() can step a walk back to 0.
+static void all_state_set(lua_State *L, int idx, int index)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &m_all_state_key);
+    lua_pushvalue(L, idx);
+    if (index >= 0)
+        lua_pushinteger(L, index);
+    else
+        lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+// Element access goes around metamethods unless the table has a metatable.
+static bool list_is_raw(lua_State *L, int idx)
+{
+    if (lua_type(L, idx) != LUA_TTABLE)
+        return false;
+    if (lua_getmetatable(L, idx)) {
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+static int list_len(lua_State *L, int idx, bool raw)
+{
+    if (raw)
+        return (int)lua_rawlen(L, idx);
+    lua_len(L, idx);
+    int len = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return len;
+}
+
+// Push t[i].
+static void list_get(lua_State *L, int idx, int i, bool raw)
+{
+    if (raw) {
+        lua_rawgeti(L, idx, i);
+    } else {
+        lua_pushinteger(L, i);
+        lua_gettable(L, idx);
+    }
+}
+
+// t[i] = value on top of the stack, which is popped.
+static void list_set(lua_State *L, int idx, int i, bool raw)
+{
+    if (raw) {
+        lua_rawseti(L, idx, i);
+    } else {
+        lua_pushinteger(L, i);
+        lua_insert(L, -2);
+        lua_settable(L, idx);
+    }
+}
+
+// Advance the all() walk over the table at idx from index *i and push the
+// next element, nil at the end.
+static void all_step(lua_State *L, int idx, int *i)
+{
+    if (lua_type(L, idx) != LUA_TTABLE) {
+        list_get(L, idx, ++*i, false); // raises the indexing error
+        return;
+    }
+
+    all_state_get(L, idx);
+    if (!lua_isnil(L, -1) && lua_tointeger(L, -1) < *i)
+        *i = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    (*i)++;
+    all_state_set(L, idx, *i);
+
+    list_get(L, idx, *i, list_is_raw(L, idx));
+    if (lua_isnil(L, -1))
+        all_state_set(L, idx, -1);
+}
+
+static int all_none(lua_State *L)
+{
+    return 0;
+}
+
+static int all_string_iter(lua_State *L)
+{
+    size_t len;
+    const char *str = lua_tolstring(L, lua_upvalueindex(1), &len);
+    int i = lua_tointeger(L, lua_upvalueindex(2)) + 1;
+
+    if (i > (int)len)
+        return 0;
+    lua_pushinteger(L, i);
+    lua_replace(L, lua_upvalueindex(2));
+    lua_pushlstring(L, str + i - 1, 1);
+    return 1;
+}
+
+static int all_table_iter(lua_State *L)
+{
+    int i = lua_tointeger(L, lua_upvalueindex(2));
+
+    all_step(L, lua_upvalueindex(1), &i);
+    lua_pushinteger(L, i);
+    lua_replace(L, lua_upvalueindex(2));
+    return 1;
+}
+
 // add(tbl, v)
+int add(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE)
+        return 0;
+
+    lua_settop(L, 2);
+    bool raw = list_is_raw(L, 1);
+    int len = list_len(L, 1, raw);
+    lua_pushvalue(L, 2);
+    list_set(L, 1, len + 1, raw);
+
+    return 1;
+}
+
 // all(tbl)
-// count(tbl)
+int all(lua_State *L)
+{
+    if (lua_isnoneornil(L, 1)) {
+        lua_pushcfunction(L, all_none);
+        return 1;
+    }
+
+    lua_settop(L, 1);
+    lua_pushinteger(L, 0);
+    lua_pushcclosure(L, lua_type(L, 1) == LUA_TSTRING ? all_string_iter : all_table_iter, 2);
+
+    return 1;
+}
+
+// count(tbl, [v])
+int count(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_settop(L, 2);
+    bool raw = list_is_raw(L, 1);
+    int len = list_len(L, 1, raw);
+
+    if (lua_isnil(L, 2)) {
+        lua_pushinteger(L, len);
+        return 1;
+    }
+
+    int n = 0;
+    for (int i = 1; i <= len; i++) {
+        list_get(L, 1, i, raw);
+        if (lua_compare(L, -1, 2, LUA_OPEQ))
+            n++;
+        lua_pop(L, 1);
+    }
+    lua_pushinteger(L, n);
+
+    return 1;
+}
+
 // del(tbl, v)
+int del(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE)
+        return 0;
+
+    lua_settop(L, 2);
+    bool raw = list_is_raw(L, 1);
+    int len = list_len(L, 1, raw);
+    int removed_index = 0;
+    bool found = false;
+
+    // matches keep being checked after the first, so removed_index ends up
+    // at the last one
+    for (int i = 1; i <= len; i++) {
+        list_get(L, 1, i, raw);
+        if (lua_compare(L, -1, 2, LUA_OPEQ)) {
+            removed_index = i;
+            found = true;
+        }
+        lua_pop(L, 1);
+        if (found) {
+            list_get(L, 1, i + 1, raw);
+            list_set(L, 1, i, raw);
+        }
+    }
+
+    // keep an all() walk over this table from skipping the next element
+    if (removed_index) {
+        all_state_get(L, 1);
+        if (!lua_isnil(L, -1) && removed_index <= lua_tointeger(L, -1))
+            all_state_set(L, 1, lua_tointeger(L, -1) - 1);
+        lua_pop(L, 1);
+    }
+
+    if (!found)
+        return 0;
+    lua_pushvalue(L, 2);
+
+    return 1;
+}
+
+// deli(tbl, [i])
+int deli(lua_State *L)
+{
+    if (lua_type(L, 1) != LUA_TTABLE)
+        return 0;
+
+    lua_settop(L, 2);
+    bool raw = list_is_raw(L, 1);
+    int len = list_len(L, 1, raw);
+    int i = lua_isnil(L, 2) ? len : lua_tointeger(L, 2);
+
+    if (i < 1 || i > len) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    list_get(L, 1, i, raw);
+    for (int j = i; j <= len; j++) {
+        list_get(L, 1, j + 1, raw);
+        list_set(L, 1, j, raw);
+    }
+
+    return 1;
+}
+
+static int foreach_continue(lua_State *L);
+
+// Runs the loop body of foreach from walk index i; also the continuation
+// when func yields.
+static int foreach_loop(lua_State *L, int i)
+{
+    for (;;) {
+        lua_pushvalue(L, 2);
+        if (lua_type(L, 1) == LUA_TSTRING) {
+            size_t len;
+            const char *str = lua_tolstring(L, 1, &len);
+            if (++i > (int)len)
+                return 0;
+            lua_pushlstring(L, str + i - 1, 1);
+        } else {
+            all_step(L, 1, &i);
+            if (lua_isnil(L, -1))
+                return 0;
+        }
+        lua_callk(L, 1, 0, i, foreach_continue);
+    }
+}
+
+static int foreach_continue(lua_State *L)
+{
+    int i = 0;
+    lua_getctx(L, &i);
+    return foreach_loop(L, i);
+}
+
 // foreach(tbl, func)
+int foreach(lua_State *L)
+{
+    if (lua_isnoneornil(L, 1))
+        return 0;
+
+    lua_settop(L, 2);
+
+    return foreach_loop(L, 0);
+}
+
 // pairs(tbl)
 
 // ****************************************************************
@@ -915,19 +1303,13 @@ int sfx(lua_State *L)
 // *** Map ***
 // ****************************************************************
 
-static void map_get_visible_cells(int sx, int sy, int celw, int celh,
+static void map_get_visible_cells(const draw_state_t *ds, int sx, int sy, int celw, int celh,
                                    int *start_x, int *start_y, int *end_x, int *end_y)
 {
-    int cam_x, cam_y;
-    camera_get(&cam_x, &cam_y);
-
-    int clip_x0, clip_y0, clip_x1, clip_y1;
-    clip_get(&clip_x0, &clip_y0, &clip_x1, &clip_y1);
-
-    int screen_x0 = cam_x + clip_x0;
-    int screen_y0 = cam_y + clip_y0;
-    int screen_x1 = cam_x + clip_x1;
-    int screen_y1 = cam_y + clip_y1;
+    int screen_x0 = ds->camera_x + ds->clip_x0;
+    int screen_y0 = ds->camera_y + ds->clip_y0;
+    int screen_x1 = ds->camera_x + ds->clip_x1;
+    int screen_y1 = ds->camera_y + ds->clip_y1;
 
     int visible_x0 = (screen_x0 - sx) / SPRITE_WIDTH;
     int visible_y0 = (screen_y0 - sy) / SPRITE_HEIGHT;
@@ -958,23 +1340,40 @@ int map(lua_State *L)
     int celh = lua_gettop(L) >= 6 ? lua_tointeger(L, 6) : default_celh;
     int layer = lua_gettop(L) >= 7 ? lua_tointeger(L, 7) : 0;
 
+    draw_state_t ds;
+    draw_state_init(&ds);
+
     int start_x, start_y, end_x, end_y;
-    map_get_visible_cells(sx, sy, celw, celh, &start_x, &start_y, &end_x, &end_y);
+    map_get_visible_cells(&ds, sx, sy, celw, celh, &start_x, &start_y, &end_x, &end_y);
+
+    if (start_x >= end_x)
+        return 0;
+
+    uint8_t *sprite_flags = &m_memory[MEMORY_SPRITEFLAGS];
+    bool sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
 
     for (int y = start_y; y < end_y; y++)
     {
+        // walk the row's cell bytes directly when the whole visible span
+        // lies in one mapped region, otherwise check each cell
+        int row = map_row_addr(cely + y);
+        int first = row + celx + start_x;
+        int last = row + celx + end_x - 1;
+        const uint8_t *cells = NULL;
+        if (row >= 0 && celx + start_x >= 0 && map_addr_valid(first) && map_addr_valid(last) &&
+            (first < 0x3000) == (last < 0x3000))
+            cells = m_memory + row + celx;
+
         for (int x = start_x; x < end_x; x++)
         {
-            uint8_t index = map_get(celx + x, cely + y);
-            uint8_t sprite_flags = m_memory[MEMORY_SPRITEFLAGS + index];
-            bool sprite_0_opaque = (m_memory[MEMORY_MISCFLAGS] & 0x8) != 0;
-            bool should_draw = (index != 0 || sprite_0_opaque) && (layer == 0 || ((layer & sprite_flags) == layer));
+            uint8_t index = cells ? cells[x] : map_get(celx + x, cely + y);
+            bool should_draw = (index != 0 || sprite_0_opaque) && (layer == 0 || ((layer & sprite_flags[index]) == layer));
 
             if (should_draw)
             {
                 int left = sx + x * SPRITE_WIDTH;
                 int top = sy + y * SPRITE_HEIGHT;
-                draw_sprite(index, left, top, false, false);
+                draw_sprite(&ds, index, left, top, false, false);
             }
         }
     }
@@ -1778,6 +2177,8 @@ int serial(lua_State *L)
 
 void lua_register_functions(lua_State *L)
 {
+    all_state_create(L);
+
     // ****************************************************************
     // *** Graphics ***
     // ****************************************************************
@@ -1812,11 +2213,12 @@ void lua_register_functions(lua_State *L)
     // ****************************************************************
     // *** Tables ***
     // ****************************************************************
-    // lua_register(L, "add", add);
-    // lua_register(L, "all", all);
-    // lua_register(L, "count", count);
-    // lua_register(L, "del", del);
-    // lua_register(L, "foreach", foreach);
+    lua_register(L, "add", add);
+    lua_register(L, "all", all);
+    lua_register(L, "count", count);
+    lua_register(L, "del", del);
+    lua_register(L, "deli", deli);
+    lua_register(L, "foreach", foreach);
     // lua_register(L, "pairs", pairs);
     // ****************************************************************
     // *** Input ***
@@ -1961,11 +2363,25 @@ static void lua_event_pump_hook(lua_State *L, lua_Debug *ar)
     p8_pump_events();
 }
 
+static int lua_panic(lua_State *L)
+{
+    printf("PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+    return 0;
+}
+
+static lua_State *lua_new_state(void)
+{
+    lua_State *state = lua_newstate(lua_heap_alloc, NULL);
+    if (state)
+        lua_atpanic(state, lua_panic);
+    return state;
+}
+
 void lua_load_api()
 {
     if (!L)
     {
-        L = luaL_newstate();
+        L = lua_new_state();
     }
 
     luaL_openlibs(L);
@@ -1986,6 +2402,7 @@ void lua_shutdown_api()
     if (L) {
         lua_close(L);
         L = NULL;
+        lua_heap_release();
     }
 }
 
@@ -2036,13 +2453,147 @@ void lua_print_error(const char *where)
     }
 }
 
+// Compiled chunks are cached under m_bytecode_cache_dir, named by a hash of
+// the source. Bump BYTECODE_CACHE_VERSION whenever the compiler or the
+// opcode set changes, the lundump header does not cover either.
+#define BYTECODE_CACHE_VERSION 1
+#define BYTECODE_CACHE_MAGIC "p8bc"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t source_size;
+    uint32_t chunk_hash;
+} bytecode_cache_header_t;
+
+typedef struct {
+    FILE *file;
+    uint64_t hash;
+} bytecode_cache_writer_t;
+
+#define BYTECODE_HASH_BASIS 0xcbf29ce484222325ull
+
+static uint64_t bytecode_hash(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static char *bytecode_cache_path(const char *chunk_name, const char *source, size_t size)
+{
+    uint32_t version = BYTECODE_CACHE_VERSION;
+    uint64_t hash = BYTECODE_HASH_BASIS;
+    hash = bytecode_hash(hash, &version, sizeof(version));
+    // the chunk name ends up in error messages, so it is part of the key
+    hash = bytecode_hash(hash, chunk_name, strlen(chunk_name) + 1);
+    hash = bytecode_hash(hash, source, size);
+
+    size_t len = strlen(m_bytecode_cache_dir) + 1 + 16 + 5 + 1;
+    char *path = malloc(len);
+    snprintf(path, len, "%s/%016llx.luac", m_bytecode_cache_dir, (unsigned long long)hash);
+    return path;
+}
+
+// Push the cached chunk, returns false if there is no usable one.
+static bool bytecode_cache_load(const char *path, const char *chunk_name, size_t source_size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    bytecode_cache_header_t header;
+    char *chunk = NULL;
+    long size = 0;
+    bool ok = false;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, BYTECODE_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == BYTECODE_CACHE_VERSION &&
+        header.source_size == source_size &&
+        fseek(file, 0, SEEK_END) == 0 &&
+        (size = ftell(file) - (long)sizeof(header)) > 0 &&
+        fseek(file, sizeof(header), SEEK_SET) == 0) {
+        chunk = malloc(size);
+        if (chunk && fread(chunk, 1, size, file) == (size_t)size &&
+            (uint32_t)bytecode_hash(BYTECODE_HASH_BASIS, chunk, size) == header.chunk_hash) {
+            ok = luaL_loadbufferx(L, chunk, size, chunk_name, "b") == LUA_OK;
+            if (!ok)
+                lua_pop(L, 1);
+        }
+    }
+
+    free(chunk);
+    fclose(file);
+    return ok;
+}
+
+static int bytecode_cache_writer(lua_State *L, const void *p, size_t size, void *ud)
+{
+    bytecode_cache_writer_t *writer = ud;
+    writer->hash = bytecode_hash(writer->hash, p, size);
+    return fwrite(p, 1, size, writer->file) != size;
+}
+
+// Dump the chunk on top of the stack, going through a temporary file so an
+// interrupted write never leaves a truncated chunk behind.
+static void bytecode_cache_store(const char *path, size_t source_size)
+{
+    size_t len = strlen(path) + 5;
+    char *temp_path = malloc(len);
+    snprintf(temp_path, len, "%s.tmp", path);
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file) {
+        bytecode_cache_header_t header;
+        memcpy(header.magic, BYTECODE_CACHE_MAGIC, sizeof(header.magic));
+        header.version = BYTECODE_CACHE_VERSION;
+        header.source_size = source_size;
+        header.chunk_hash = 0;
+
+        // the header is written again once the chunk hash is known
+        bytecode_cache_writer_t writer = { file, BYTECODE_HASH_BASIS };
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  lua_dump(L, bytecode_cache_writer, &writer) == 0;
+        header.chunk_hash = (uint32_t)writer.hash;
+        ok = ok && fseek(file, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(temp_path, path) != 0)
+            remove(temp_path);
+    }
+
+    free(temp_path);
+}
+
+static int lua_load_script(const char *chunk_name, const char *source, size_t size)
+{
+    if (!m_bytecode_cache_dir)
+        return luaL_loadbuffer(L, source, size, chunk_name);
+
+    char *path = bytecode_cache_path(chunk_name, source, size);
+    int ret = LUA_OK;
+
+    if (!bytecode_cache_load(path, chunk_name, size)) {
+        ret = luaL_loadbuffer(L, source, size, chunk_name);
+        if (ret == LUA_OK)
+            bytecode_cache_store(path, size);
+    }
+
+    free(path);
+    return ret;
+}
+
 void lua_init_script(const char *file_name, const char *script)
 {
     free(s_saved_script);
     s_saved_script = script ? strdup(script) : NULL;
 
     if (!L)
-        L = luaL_newstate();
+        L = lua_new_state();
 
     char *temp_file_name = malloc(strlen(file_name) + 2);
     temp_file_name[0] = '@';
@@ -2055,7 +2606,7 @@ void lua_init_script(const char *file_name, const char *script)
     char *padded_script = malloc(3 + script_len + 1);
     padded_script[0] = padded_script[1] = padded_script[2] = '\n';
     memcpy(padded_script + 3, script, script_len + 1);
-    int ret = luaL_loadbuffer(L, padded_script, 3 + script_len, temp_file_name);
+    int ret = lua_load_script(temp_file_name, padded_script, 3 + script_len);
     free(padded_script);
 #else
     int ret = lua_loadBuffer(L, script, strlen(script), temp_file_name);
@@ -0,0 +1,296 @@
+/*
+ * p8_lua_heap.c
+ *
+ *  Blocks up to HEAP_SMALL_MAX bytes come from per size class free lists.
+ *  The pages behind them are bumped out of large arena chunks. Bigger
+ *  blocks (table arrays, stacks, long strings) go to the system heap. Lua
+ *  passes the old size of every block it frees or resizes, so blocks carry
+ *  no header. Only the main thread touches the Lua state, so nothing here
+ *  is locked.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lua.h"
+#include "p8_emu.h"
+#include "p8_lua_heap.h"
+#ifdef OS_FREERTOS
+#include "retro_heap.h"
+#define heap_sys_malloc rh_malloc
+#define heap_sys_free rh_free
+#else
+#define heap_sys_malloc malloc
+#define heap_sys_free free
+#endif
+
+#define HEAP_ALIGN 8
+#define HEAP_SMALL_MAX 256
+#define HEAP_PAGE_SIZE 4096
+#define HEAP_CHUNK_SIZE (64 * 1024)
+#define HEAP_CHUNK_HEADER 16
+
+// Lua tags the first allocation of each object with its type, proto and
+// upvalue use the two internal tags after LUA_NUMTAGS
+#define HEAP_TYPE_COUNT (LUA_NUMTAGS + 2)
+
+static const uint16_t m_class_size[] = {
+    8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256
+};
+
+#define HEAP_CLASS_COUNT (sizeof(m_class_size) / sizeof(m_class_size[0]))
+
+// Size class for each 8 byte step up to HEAP_SMALL_MAX
+static const uint8_t m_class_index[HEAP_SMALL_MAX / HEAP_ALIGN + 1] = {
+    0, 0, 1, 2, 3, 4, 5, 6, 7,
+    8, 8, 9, 9, 10, 10, 11, 11,
+    12, 12, 12, 12, 13, 13, 13, 13,
+    14, 14, 14, 14, 15, 15, 15, 15
+};
+
+static const char *m_type_name[HEAP_TYPE_COUNT] = {
+    "other", NULL, NULL, NULL, "string", "table", "function",
+    "userdata", "thread", "proto", "upvalue"
+};
+
+typedef struct heap_block {
+    struct heap_block *next;
+} heap_block_t;
+
+typedef struct heap_chunk {
+    struct heap_chunk *next;
+} heap_chunk_t;
+
+typedef struct {
+    heap_block_t *free_list;
+    unsigned pages;
+    unsigned live;
+    unsigned peak;
+    unsigned long allocs;
+} heap_class_t;
+
+static struct {
+    heap_class_t classes[HEAP_CLASS_COUNT];
+    heap_chunk_t *chunks;
+    unsigned chunk_count;
+    uint8_t *bump;
+    uint8_t *bump_end;
+    size_t in_use;
+    size_t peak;
+    size_t limit;
+    size_t large_bytes;
+    unsigned long large_allocs;
+    unsigned long failed;
+    unsigned long type_allocs[HEAP_TYPE_COUNT];
+    size_t type_bytes[HEAP_TYPE_COUNT];
+} m_heap;
+
+static inline int heap_class(size_t size)
+{
+    return size <= HEAP_SMALL_MAX ? m_class_index[(size + HEAP_ALIGN - 1) / HEAP_ALIGN] : -1;
+}
+
+static bool heap_add_page(heap_class_t *cls, unsigned size)
+{
+    if (m_heap.bump_end - m_heap.bump < HEAP_PAGE_SIZE) {
+        heap_chunk_t *chunk = heap_sys_malloc(HEAP_CHUNK_SIZE);
+        if (!chunk)
+            return false;
+        chunk->next = m_heap.chunks;
+        m_heap.chunks = chunk;
+        m_heap.chunk_count++;
+        m_heap.bump = (uint8_t *)chunk + HEAP_CHUNK_HEADER;
+        m_heap.bump_end = (uint8_t *)chunk + HEAP_CHUNK_SIZE;
+    }
+
+    uint8_t *page = m_heap.bump;
+    m_heap.bump += HEAP_PAGE_SIZE;
+    cls->pages++;
+
+    // push in reverse so blocks are handed out in address order
+    unsigned count = HEAP_PAGE_SIZE / size;
+    for (unsigned i = count; i-- > 0;) {
+        heap_block_t *block = (heap_block_t *)(page + i * size);
+        block->next = cls->free_list;
+        cls->free_list = block;
+    }
+
+    return true;
+}
+
+static void *heap_malloc(size_t size)
+{
+    int index = heap_class(size);
+
+    if (index < 0) {
+        void *block = heap_sys_malloc(size);
+        if (block) {
+            m_heap.large_bytes += size;
+            m_heap.large_allocs++;
+        }
+        return block;
+    }
+
+    heap_class_t *cls = &m_heap.classes[index];
+    if (!cls->free_list && !heap_add_page(cls, m_class_size[index]))
+        return NULL;
+
+    heap_block_t *block = cls->free_list;
+    cls->free_list = block->next;
+    cls->allocs++;
+    if (++cls->live > cls->peak)
+        cls->peak = cls->live;
+
+    return block;
+}
+
+static void heap_free(void *ptr, size_t size)
+{
+    int index = heap_class(size);
+
+    if (index < 0) {
+        heap_sys_free(ptr);
+        m_heap.large_bytes -= size;
+        return;
+    }
+
+    heap_class_t *cls = &m_heap.classes[index];
+    heap_block_t *block = ptr;
+    block->next = cls->free_list;
+    cls->free_list = block;
+    cls->live--;
+}
+
+static void *heap_realloc(void *ptr, size_t osize, size_t nsize)
+{
+    int old_index = heap_class(osize);
+    int new_index = heap_class(nsize);
+
+    if (old_index >= 0 && old_index == new_index)
+        return ptr;
+
+#ifndef OS_FREERTOS
+    if (old_index < 0 && new_index < 0) {
+        void *block = realloc(ptr, nsize);
+        if (block) {
+            m_heap.large_bytes += nsize - osize;
+            m_heap.large_allocs++;
+        }
+        return block;
+    }
+#endif
+
+    void *block = heap_malloc(nsize);
+    if (!block) {
+        // Lua does not allow a shrink to fail, keep the old block. It is
+        // at least nsize bytes, so it can safely join the smaller class.
+        return nsize < osize ? ptr : NULL;
+    }
+    memcpy(block, ptr, nsize < osize ? nsize : osize);
+    heap_free(ptr, osize);
+
+    return block;
+}
+
+void *lua_heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    size_t old_size = ptr ? osize : 0;
+    (void)ud;
+
+    if (nsize == 0) {
+        if (ptr) {
+            heap_free(ptr, osize);
+            m_heap.in_use -= osize;
+        }
+        return NULL;
+    }
+
+    // emulate the PICO-8 memory cap, Lua runs a full collection and
+    // retries before raising "not enough memory"
+    if (m_heap.limit && nsize > old_size && m_heap.in_use - old_size + nsize > m_heap.limit) {
+        m_heap.failed++;
+        return NULL;
+    }
+
+    void *block;
+    if (ptr) {
+        block = heap_realloc(ptr, osize, nsize);
+    } else {
+        block = heap_malloc(nsize);
+        if (block) {
+            unsigned type = osize < HEAP_TYPE_COUNT ? (unsigned)osize : 0;
+            m_heap.type_allocs[type]++;
+            m_heap.type_bytes[type] += nsize;
+        }
+    }
+
+    if (!block) {
+        m_heap.failed++;
+        return NULL;
+    }
+
+    m_heap.in_use = m_heap.in_use - old_size + nsize;
+    if (m_heap.in_use > m_heap.peak)
+        m_heap.peak = m_heap.in_use;
+
+    return block;
+}
+
+// 0 disables the cap
+void lua_heap_set_limit(size_t bytes)
+{
+    m_heap.limit = bytes;
+}
+
+size_t lua_heap_in_use(void)
+{
+    return m_heap.in_use;
+}
+
+// Hand the arena back to the system once the Lua state has been closed.
+// The statistics carry over so the totals cover the whole session.
+void lua_heap_release(void)
+{
+    if (m_heap.in_use != 0)
+        return;
+
+    while (m_heap.chunks) {
+        heap_chunk_t *next = m_heap.chunks->next;
+        heap_sys_free(m_heap.chunks);
+        m_heap.chunks = next;
+    }
+    m_heap.chunk_count = 0;
+    m_heap.bump = m_heap.bump_end = NULL;
+
+    for (unsigned i = 0; i < HEAP_CLASS_COUNT; i++) {
+        m_heap.classes[i].free_list = NULL;
+        m_heap.classes[i].pages = 0;
+    }
+}
+
+void lua_heap_print_stats(void)
+{
+    printf("Lua heap: %u KB in use, %u KB peak, %u KB arena in %u chunks, %u KB large\n",
+           (unsigned)(m_heap.in_use / 1024), (unsigned)(m_heap.peak / 1024),
+           m_heap.chunk_count * (HEAP_CHUNK_SIZE / 1024), m_heap.chunk_count,
+           (unsigned)(m_heap.large_bytes / 1024));
+    if (m_heap.limit)
+        printf("  limit %u KB, %lu failed allocations\n", (unsigned)(m_heap.limit / 1024), m_heap.failed);
+
+    printf("  %5s %6s %6s %6s %10s\n", "size", "pages", "live", "peak", "allocs");
+    for (unsigned i = 0; i < HEAP_CLASS_COUNT; i++) {
+        const heap_class_t *cls = &m_heap.classes[i];
+        if (cls->allocs == 0)
+            continue;
+        printf("  %5u %6u %6u %6u %10lu\n", m_class_size[i], cls->pages, cls->live, cls->peak, cls->allocs);
+    }
+    printf("  %5s %6s %6s %6s %10lu\n", "large", "", "", "", m_heap.large_allocs);
+
+    printf("  %-9s %10s %10s\n", "type", "allocs", "KB");
+    for (unsigned i = 0; i < HEAP_TYPE_COUNT; i++) {
+        if (!m_type_name[i] || m_heap.type_allocs[i] == 0)
+            continue;
+        printf("  %-9s %10lu %10u\n", m_type_name[i], m_heap.type_allocs[i], (unsigned)(m_heap.type_bytes[i] / 1024));
+    }
+}
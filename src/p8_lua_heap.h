@@ -0,0 +1,19 @@
+/*
+ * p8_lua_heap.h
+ *
+ *  Allocator for the Lua state, kept apart from the system heap that SDL
+ *  and the rest of the emulator use.
+ */
+
+#ifndef P8_LUA_HEAP_H
+#define P8_LUA_HEAP_H
+
+#include <stddef.h>
+
+void *lua_heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+void lua_heap_set_limit(size_t bytes);
+size_t lua_heap_in_use(void);
+void lua_heap_release(void);
+void lua_heap_print_stats(void);
+
+#endif
@@ -11,11 +11,54 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "p8_emu.h"
 #include "p8_symbols.h"
 #include "pico_font.h"
 
+// Draw state read once per drawing call rather than per pixel: camera and
+// clip rectangle (limited to the screen), fill pattern, the 0x5f54/0x5f55
+// remaps, the 0x5f5e read/write mask and the draw and secondary palettes.
+typedef struct {
+    int camera_x, camera_y;
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+    int fillp;
+    uint8_t fillp_attr;
+    uint8_t rw_mask;
+    uint8_t *screen;
+    uint8_t *sprites;
+    const uint8_t *palette;
+    const uint8_t *palette_secondary;
+} draw_state_t;
+
+// Packed fill for one row phase (y & 3) of the fill pattern: the pixel pair
+// written at even and odd byte columns, and the nibbles of each byte that
+// may be modified (fill pattern transparency and the 0x5f5e write mask).
+typedef struct {
+    uint8_t value[2];
+    uint8_t mask[2];
+} fill_row_t;
+
+typedef struct {
+    const draw_state_t *state;
+    fill_row_t rows[4];
+} fill_style_t;
+
+typedef struct {
+    uint8_t value[256];
+    uint8_t mask[256];
+} sprite_table_t;
+
+// Horizontal extent (draw coordinates) of a filled shape on each screen row
+// inside the clip rectangle; rows with left > right are empty. Everything
+// added to one list has to overlap on the rows it shares, so that each row
+// stays a single span.
+typedef struct {
+    int left[P8_HEIGHT];
+    int right[P8_HEIGHT];
+} span_list_t;
+
 static inline void clear_screen(int color);
 static inline void draw_circ(int x, int y, int r, int col, int fillp);
 static inline void draw_circ_mask(int x, int y, int r, int col, int fillp, int mask);
@@ -23,15 +66,21 @@ static inline void draw_circfill(int x, int y, int r, int col, int fillp);
 static inline void draw_circfill_mask(int x, int y, int r, int col, int fillp, int mask);
 static inline void draw_oval(int x0, int y0, int x1, int y1, int col, int fillp);
 static inline void draw_ovalfill(int x0, int y0, int x1, int y1, int col, int fillp);
-static inline void draw_sprite(int n, int left, int top, bool flip_x, bool flip_y);
-static inline void draw_scaled_sprite(int sx, int sy, int sw, int sh, int dx, int dy, float scale_x, float scale_y, bool flip_x, bool flip_y);
+static inline void draw_sprite(const draw_state_t *ds, int n, int left, int top, bool flip_x, bool flip_y);
+static inline bool blit_sprite(const draw_state_t *ds, int n, int left, int top, bool flip_x, bool flip_y);
+static inline const sprite_table_t *sprite_table_get(const draw_state_t *ds);
+static inline void draw_scaled_sprite(int sx, int sy, int sw, int sh, int dx, int dy, int dw, int dh, bool flip_x, bool flip_y);
+static inline bool blit_scaled_sprite(const draw_state_t *ds, int sx, int sy, int sw, int sh, int dx, int dy, int dw, int dh, bool flip_x, bool flip_y);
 static inline void draw_sprites(int n, int x, int y, int w, int h, bool flip_x, bool flip_y);
 static inline void draw_hline(int x0, int x1, int y, int col, int fillp);
 static inline void draw_vline(int x, int y0, int y1, int col, int fillp);
 static inline void draw_line(int x0, int y0, int x1, int y1, int col, int fillp);
+static inline void line_clip_steps(int64_t p, int s, int64_t lo, int64_t hi, int64_t *k0, int64_t *k1);
 static inline void draw_char(int n, int left, int top, int col);
+static inline uint8_t font_sheet_row(int n, int y);
 static inline void draw_rect(int x0, int y0, int x1, int y1, int col, int fillp);
 static inline void draw_rectfill(int x0, int y0, int x1, int y1, int col, int fillp);
+static inline int gfx_addr_remap(int location);
 static inline uint8_t gfx_addr_get(int x, int y, uint8_t *memory, int location, int size);
 static inline uint8_t gfx_get(int x, int y, int location, int size);
 static inline void gfx_set(int x, int y, int location, int size, int col);
@@ -45,10 +94,31 @@ static inline void clip_get(int *x0, int *y0, int *x1, int *y1);
 static inline void clip_set(int x, int y, int w, int h);
 static inline void cursor_get(int *x, int *y);
 static inline void cursor_set(int x, int y, int col);
+static inline void draw_state_init(draw_state_t *ds);
 static inline void pixel_set(int x, int y, int c, int fillp, int draw_type);
+static inline void pixel_set_state(const draw_state_t *ds, int x, int y, int c, int fillp, int draw_type);
+static inline int pixel_fillp(const draw_state_t *ds, int c, int fillp);
+static inline int pixel_color(const draw_state_t *ds, int c, int draw_type, bool on);
+static inline void screen_pixel_write(const draw_state_t *ds, int x, int y, int col);
+static inline uint8_t sprite_pixel_get(const draw_state_t *ds, int x, int y);
+static inline void clip_get_screen(int *x0, int *y0, int *x1, int *y1);
+static inline void fill_style_init(fill_style_t *style, const draw_state_t *ds, int c, int fillp, int draw_type);
+static inline void fill_style_solid(fill_style_t *style, const draw_state_t *ds, int col);
+static inline void fill_pixel(const fill_style_t *style, int x, int y);
+static inline void fill_span_clipped(const fill_style_t *style, int x0, int x1, int y);
+static inline void fill_span(const fill_style_t *style, int x0, int x1, int y);
+static inline void fill_rect(const fill_style_t *style, int x0, int y0, int x1, int y1);
+static inline void fill_row_bits(const fill_style_t *style, unsigned bits, int left, int y, int scale_x);
+static inline void span_list_init(span_list_t *spans);
+static inline void span_list_add(span_list_t *spans, const draw_state_t *ds, int x0, int x1, int y);
+static inline void span_list_add_rect(span_list_t *spans, const draw_state_t *ds, int x0, int y0, int x1, int y1);
+static inline void span_list_add_oval(span_list_t *spans, const draw_state_t *ds, int xc, int yc, int xr, int yr, int mask);
+static inline void fill_spans(const fill_style_t *style, const span_list_t *spans);
 static inline void draw_simple_text(const char *str, int x, int y, int col);
 static inline bool is_button_set(int index, int button, bool prev_buttons);
 static inline void update_buttons(int index, int button, bool state);
+static inline int map_row_addr(int cely);
+static inline bool map_addr_valid(int address);
 static inline int map_cell_addr(int celx, int cely);
 static inline void map_set(int celx, int cely, int snum);
 static inline uint8_t map_get(int celx, int cely);
@@ -59,11 +129,13 @@ static inline int left_margin_get(void);
 
 static inline void clear_screen(int color)
 {
-    color = color_get(PALTYPE_DRAW, color);
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_solid(&style, &ds, ds.palette[color & 0xf]);
 
     for (int y = 0; y < P8_HEIGHT; y++)
-        for (int x = 0; x < P8_WIDTH; x++)
-            gfx_set(x, y, MEMORY_SCREEN, MEMORY_SCREEN_SIZE, color);
+        fill_span_clipped(&style, 0, P8_WIDTH - 1, y);
 
     clip_set(0, 0, P8_WIDTH, P8_HEIGHT);
     cursor_set(0, 0, -1);
@@ -79,24 +151,24 @@ static inline int dash_direction_y(int facing)
     return 0;
 }
 
-static inline void draw_oval_segment(int xc, int yc, int x, int y, int r, int xr, int yr, int col, int fillp, int mask)
+static inline void draw_oval_segment(const fill_style_t *style, int xc, int yc, int x, int y, int r, int xr, int yr, int mask)
 {
     if (mask & 1)
-        pixel_set(xc + x * xr / r, yc + y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc + x * xr / r, yc + y * yr / r);
     if (mask & 2)
-        pixel_set(xc - x * xr / r, yc + y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc - x * xr / r, yc + y * yr / r);
     if (mask & 4)
-        pixel_set(xc + x * xr / r, yc - y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc + x * xr / r, yc - y * yr / r);
     if (mask & 8)
-        pixel_set(xc - x * xr / r, yc - y * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc - x * xr / r, yc - y * yr / r);
     if (mask & 16)
-        pixel_set(xc + y * xr / r, yc + x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc + y * xr / r, yc + x * yr / r);
     if (mask & 32)
-        pixel_set(xc - y * xr / r, yc + x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc - y * xr / r, yc + x * yr / r);
     if (mask & 64)
-        pixel_set(xc + y * xr / r, yc - x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc + y * xr / r, yc - x * yr / r);
     if (mask & 128)
-        pixel_set(xc - y * xr / r, yc - x * yr / r, col, fillp, DRAWTYPE_GRAPHIC);
+        fill_pixel(style, xc - y * xr / r, yc - x * yr / r);
 }
 
 static inline void draw_oval_mask(int xc, int yc, int xr, int yr, int col, int fillp, int mask)
@@ -107,7 +179,12 @@ static inline void draw_oval_mask(int xc, int yc, int xr, int yr, int col, int f
     int x = 0, y = abs(r);
     int d = 3 - 2 * abs(r);
 
-    draw_oval_segment(xc, yc, x, y, r, xr, yr, col, fillp, mask);
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+
+    draw_oval_segment(&style, xc, yc, x, y, r, xr, yr, mask);
 
     while (y >= x)
     {
@@ -121,7 +198,7 @@ static inline void draw_oval_mask(int xc, int yc, int xr, int yr, int col, int f
         else
             d = d + 4 * x + 6;
 
-        draw_oval_segment(xc, yc, x, y, r, xr, yr, col, fillp, mask);
+        draw_oval_segment(&style, xc, yc, x, y, r, xr, yr, mask);
     }
 }
 
@@ -135,85 +212,145 @@ static inline void draw_circ(int xc, int yc, int r, int col, int fillp)
     draw_circ_mask(xc, yc, r, col, fillp, 0xff);
 }
 
-static inline void draw_line(int x0, int y0, int x1, int y1, int col, int fillp)
+// Range [*k0, *k1] of steps k >= 0 for which p + s * k lies in [lo, hi].
+static inline void line_clip_steps(int64_t p, int s, int64_t lo, int64_t hi, int64_t *k0, int64_t *k1)
 {
-    int dx = abs(x1 - x0);
-    int sx = x0 < x1 ? 1 : -1;
-    int dy = -abs(y1 - y0);
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
-
-    while (true)
-    {
-        pixel_set(x0, y0, col, fillp, DRAWTYPE_GRAPHIC);
+    if (s > 0) {
+        *k0 = MAX(*k0, lo - p);
+        *k1 = MIN(*k1, hi - p);
+    } else {
+        *k0 = MAX(*k0, p - hi);
+        *k1 = MIN(*k1, p - lo);
+    }
+}
 
-        if (x0 == x1 && y0 == y1)
-            break;
+static inline void draw_line(int x0, int y0, int x1, int y1, int col, int fillp)
+{
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
 
-        int e2 = 2 * err;
+    if (y0 == y1) {
+        fill_rect(&style, MIN(x0, x1), y0, MAX(x0, x1), y0);
+        return;
+    }
+    if (x0 == x1) {
+        fill_rect(&style, x0, MIN(y0, y1), x0, MAX(y0, y1));
+        return;
+    }
 
-        if (e2 >= dy)
-        {
-            err += dy;
+    // Bresenham steps the major axis once per pixel; after k steps the minor
+    // axis has moved floor((2 * minor * k + major) / (2 * major)). That lets
+    // the walk start and stop at the clip rect instead of the end points.
+    bool x_major = abs(x1 - x0) >= abs(y1 - y0);
+    int64_t p = x_major ? x0 : y0;
+    int64_t q = x_major ? y0 : x0;
+    int ps = (x_major ? x0 < x1 : y0 < y1) ? 1 : -1;
+    int qs = (x_major ? y0 < y1 : x0 < x1) ? 1 : -1;
+    int64_t major = x_major ? abs(x1 - x0) : abs(y1 - y0);
+    int64_t minor = x_major ? abs(y1 - y0) : abs(x1 - x0);
+
+    int64_t left = ds.clip_x0 + ds.camera_x;
+    int64_t right = ds.clip_x1 - 1 + ds.camera_x;
+    int64_t top = ds.clip_y0 + ds.camera_y;
+    int64_t bottom = ds.clip_y1 - 1 + ds.camera_y;
+
+    int64_t k0 = 0, k1 = major;
+    line_clip_steps(p, ps, x_major ? left : top, x_major ? right : bottom, &k0, &k1);
+
+    // minor axis offsets m0..m1 that are visible, as a range of k
+    int64_t m0 = 0, m1 = minor;
+    line_clip_steps(q, qs, x_major ? top : left, x_major ? bottom : right, &m0, &m1);
+    if (k0 > k1 || m0 > m1)
+        return;
+    // smallest k with offset >= m0, largest k with offset <= m1
+    k0 = MAX(k0, (2 * major * m0 - major + 2 * minor - 1) / (2 * minor));
+    k1 = MIN(k1, (2 * major * (m1 + 1) - major - 1) / (2 * minor));
+
+    int64_t num = 2 * minor * k0 + major;
+    int64_t m = num / (2 * major);
+    int64_t rem = num % (2 * major);
+
+    for (int64_t k = k0; k <= k1; k++) {
+        int64_t a = p + ps * k;
+        int64_t b = q + qs * m;
+        if (x_major)
+            fill_pixel(&style, (int)a, (int)b);
+        else
+            fill_pixel(&style, (int)b, (int)a);
 
-            x0 += sx;
-        }
-
-        if (e2 <= dx)
-        {
-            err += dx;
-            y0 += sy;
+        rem += 2 * minor;
+        if (rem >= 2 * major) {
+            rem -= 2 * major;
+            m++;
         }
     }
 }
 
 static inline void draw_hline(int x0, int y, int x1, int col, int fillp)
 {
-    for (int x=x0;x<=x1;x++)
-        pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+    fill_rect(&style, x0, y, x1, y);
 }
 
 static inline void draw_vline(int x, int y0, int y1, int col, int fillp)
 {
-    for (int y=y0;y<=y1;y++)
-        pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+    fill_rect(&style, x, y0, x, y1);
 }
 
-static inline void draw_ovalfill_segment(int xc, int yc, int x, int y, int r, int xr, int yr, int col, int fillp, int mask)
+static inline bool fillp_invert_enabled(int color)
 {
-    if (mask & 1)
-        draw_hline(xc, yc + y * yr / r, xc + x * xr / r, col, fillp);
-    if (mask & 2)
-        draw_hline(xc - x * xr / r, yc + y * yr / r, xc, col, fillp);
-    if (mask & 4)
-        draw_hline(xc, yc - y * yr / r, xc + x * xr / r, col, fillp);
-    if (mask & 8)
-        draw_hline(xc - x * xr / r, yc - y * yr / r, xc, col, fillp);
-    if (mask & 16)
-        draw_hline(xc, yc + x * yr / r, xc + y * xr / r, col, fillp);
-    if (mask & 32)
-        draw_hline(xc - y * xr / r, yc + x * yr / r, xc, col, fillp);
-    if (mask & 64)
-        draw_hline(xc, yc - x * yr / r, xc + y * xr / r, col, fillp);
-    if (mask & 128)
-        draw_hline(xc - y * xr / r, yc - x * yr / r, xc, col, fillp);
+    return (m_memory[MEMORY_COLOR_FILLP] & 0x3) == 0x3 && (color & 0x1800) == 0x1800;
 }
 
-static inline bool fillp_invert_enabled(int color)
+// Largest d with d * d <= n.
+static inline int64_t isqrt64(int64_t n)
 {
-    return (m_memory[MEMORY_COLOR_FILLP] & 0x3) == 0x3 && (color & 0x1800) == 0x1800;
+    if (n <= 0)
+        return 0;
+
+    int64_t d = (int64_t)sqrt((double)n);
+    while (d * d > n)
+        d--;
+    while ((d + 1) * (d + 1) <= n)
+        d++;
+    return d;
 }
 
-static inline bool point_in_oval(int x, int y, int xc, int yc, int xr, int yr)
+// Half width of row dy (relative to the centre) of the oval
+// dx^2 * yr^2 + dy^2 * xr^2 <= xr^2 * yr^2, or -1 if the row misses it.
+static inline int oval_row_half_width(int dy, int xr, int yr)
 {
     if (xr <= 0 || yr <= 0)
-        return false;
+        return -1;
+
+    int64_t rem = (int64_t)xr * xr * yr * yr - (int64_t)dy * dy * xr * xr;
+    if (rem < 0)
+        return -1;
+
+    return (int)isqrt64(rem / ((int64_t)yr * yr));
+}
+
+// Inset from both ends of row y of a rounded rect with corner radius r, or
+// -1 if the row is outside it. 2 * r must fit in the width and height.
+static inline int round_rect_row_inset(int y, int top, int bottom, int r)
+{
+    if (y < top || y > bottom)
+        return -1;
+
+    if (r <= 0 || (y >= top + r && y <= bottom - r))
+        return 0;
 
-    int dx = x - xc;
-    int dy = y - yc;
-    int64_t lhs = (int64_t)dx * dx * yr * yr + (int64_t)dy * dy * xr * xr;
-    int64_t rhs = (int64_t)xr * xr * yr * yr;
-    return lhs <= rhs;
+    int cy = (y < top + r) ? (top + r) : (bottom - r);
+    return r - oval_row_half_width(y - cy, r, r);
 }
 
 static inline void draw_ovalfill_mask(int xc, int yc, int xr, int yr, int col, int fillp, int mask)
@@ -222,39 +359,33 @@ static inline void draw_ovalfill_mask(int xc, int yc, int xr, int yr, int col, i
     if (r <= 0)
         return;
 
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+
     if (fillp_invert_enabled(col)) {
+        // the bounding box minus the oval: up to two spans per row
         int left = xc - xr;
-        int top = yc - yr;
         int right = xc + xr;
-        int bottom = yc + yr;
+        int top = MAX(yc - yr, ds.clip_y0 + ds.camera_y);
+        int bottom = MIN(yc + yr, ds.clip_y1 - 1 + ds.camera_y);
         for (int y = top; y <= bottom; y++) {
-            for (int x = left; x <= right; x++) {
-                if (!point_in_oval(x, y, xc, yc, xr, yr))
-                    pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
+            int w = oval_row_half_width(y - yc, xr, yr);
+            if (w < 0) {
+                fill_rect(&style, left, y, right, y);
+            } else {
+                fill_rect(&style, left, y, xc - w - 1, y);
+                fill_rect(&style, xc + w + 1, y, right, y);
             }
         }
         return;
     }
 
-    int x = 0, y = abs(r);
-    int d = 3 - 2 * abs(r);
-
-    draw_ovalfill_segment(xc, yc, x, y, r, xr, yr, col, fillp, mask);
-
-    while (y >= x)
-    {
-        x++;
-
-        if (d > 0)
-        {
-            y--;
-            d = d + 4 * (x - y) + 10;
-        }
-        else
-            d = d + 4 * x + 6;
-
-        draw_ovalfill_segment(xc, yc, x, y, r, xr, yr, col, fillp, mask);
-    }
+    span_list_t spans;
+    span_list_init(&spans);
+    span_list_add_oval(&spans, &ds, xc, yc, xr, yr, mask);
+    fill_spans(&style, &spans);
 }
 
 static inline void draw_circfill_mask(int xc, int yc, int r, int col, int fillp, int mask)
@@ -269,56 +400,40 @@ static inline void draw_circfill(int xc, int yc, int r, int col, int fillp)
 
 static inline void draw_rect(int x0, int y0, int x1, int y1, int col, int fillp)
 {
-    draw_hline(x0, y0, x1, col, fillp);
-    draw_hline(x0, y1, x1, col, fillp);
-    draw_vline(x0, y0, y1, col, fillp);
-    draw_vline(x1, y0, y1, col, fillp);
-}
-
-static inline bool point_in_rect(int x, int y, int x0, int y0, int x1, int y1)
-{
-    return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+
+    fill_rect(&style, x0, y0, x1, y0);
+    fill_rect(&style, x0, y1, x1, y1);
+    fill_rect(&style, x0, y0, x0, y1);
+    fill_rect(&style, x1, y0, x1, y1);
 }
 
 static inline void draw_rectfill(int x0, int y0, int x1, int y1, int col, int fillp)
 {
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, fillp, DRAWTYPE_GRAPHIC);
+
     bool invert = fillp_invert_enabled(col);
     if (invert) {
-        int cx, cy;
-        camera_get(&cx, &cy);
-        int clip_x0, clip_y0, clip_x1, clip_y1;
-        clip_get(&clip_x0, &clip_y0, &clip_x1, &clip_y1);
-
-        for (int y = clip_y0; y < clip_y1; y++) {
-            for (int x = clip_x0; x < clip_x1; x++) {
-                if (!point_in_rect(x, y, x0, y0, x1, y1))
-                    pixel_set(x + cx, y + cy, col, fillp, DRAWTYPE_GRAPHIC);
+        // the clip rect minus x0,y0 - x1,y1 (taken as screen coordinates):
+        // full rows above and below, and the left and right remainders
+        for (int y = ds.clip_y0; y < ds.clip_y1; y++) {
+            if (y < y0 || y > y1 || x0 > x1) {
+                fill_span(&style, ds.clip_x0, ds.clip_x1 - 1, y);
+            } else {
+                fill_span(&style, ds.clip_x0, x0 - 1, y);
+                fill_span(&style, x1 + 1, ds.clip_x1 - 1, y);
             }
         }
         return;
     }
 
-    for (int x=x0;x<=x1;x++)
-        for(int y=y0;y<=y1;y++)
-            pixel_set(x, y, col, fillp, DRAWTYPE_GRAPHIC);
-}
-
-static inline bool point_in_round_rect(int x, int y, int left, int top, int right, int bottom, int r)
-{
-    if (x < left || x > right || y < top || y > bottom)
-        return false;
-
-    if (r <= 0)
-        return true;
-
-    if (x >= left + r && x <= right - r)
-        return true;
-    if (y >= top + r && y <= bottom - r)
-        return true;
-
-    int cx = (x < left + r) ? (left + r) : (right - r);
-    int cy = (y < top + r) ? (top + r) : (bottom - r);
-    return point_in_oval(x, y, cx, cy, r, r);
+    fill_rect(&style, x0, y0, x1, y1);
 }
 
 static inline void draw_oval(int x0, int y0, int x1, int y1, int col, int fillp)
@@ -339,63 +454,437 @@ static inline void draw_ovalfill(int x0, int y0, int x1, int y1, int col, int fi
     draw_ovalfill_mask(x, y, xr, yr, col, fillp, 0xff);
 }
 
+static inline void draw_state_init(draw_state_t *ds)
+{
+    camera_get(&ds->camera_x, &ds->camera_y);
+    clip_get_screen(&ds->clip_x0, &ds->clip_y0, &ds->clip_x1, &ds->clip_y1);
+    ds->fillp = m_memory[MEMORY_FILLP] | (m_memory[MEMORY_FILLP + 1] << 8);
+    ds->fillp_attr = m_memory[MEMORY_FILLP_ATTR];
+    ds->rw_mask = m_memory[MEMORY_RW_MASK];
+    ds->screen = m_memory + gfx_addr_remap(MEMORY_SCREEN);
+    ds->sprites = m_memory + gfx_addr_remap(MEMORY_SPRITES);
+    ds->palette = m_memory + MEMORY_PALETTES + PALTYPE_DRAW * 16;
+    ds->palette_secondary = m_memory + MEMORY_PALETTE_SECONDARY;
+}
+
+static inline int pixel_fillp(const draw_state_t *ds, int c, int fillp)
+{
+    if (c & 0x1000)
+        return fillp;
+    return ds->fillp;
+}
+
+// Resolve the palette entry pixel_set writes for colour c when the fill
+// pattern bit of the pixel is on, or -1 if the pixel is left untouched.
+static inline int pixel_color(const draw_state_t *ds, int c, int draw_type, bool on)
+{
+    bool fillp_sprites, fillp_graphics_secondary, transparency;
+    if (c & 0x1000) {
+        transparency = (c & 0x100) != 0;
+        fillp_sprites = (c & 0x200) != 0;
+        fillp_graphics_secondary = (c & 0x400) != 0;
+    } else {
+        transparency = (ds->fillp_attr & 1) != 0;
+        fillp_sprites = (ds->fillp_attr & 2) != 0;
+        fillp_graphics_secondary = (ds->fillp_attr & 4) != 0;
+    }
+    bool use_fillp = (draw_type == DRAWTYPE_GRAPHIC) || (draw_type == DRAWTYPE_SPRITE && fillp_sprites);
+    bool use_secondary_palette = (draw_type == DRAWTYPE_SPRITE  && fillp_sprites) || (draw_type == DRAWTYPE_GRAPHIC && fillp_graphics_secondary);
+    if (use_fillp && transparency && on)
+        return -1;
+    if (c == -1)
+        c = pencolor_get();
+    if (use_secondary_palette) {
+        uint8_t col_draw = ds->palette[c & 0xf];
+        uint8_t col_secondary = ds->palette_secondary[col_draw & 0xf];
+        if (on)
+            return (col_secondary >> 4) & 0xf;
+        else
+            return col_secondary & 0xf;
+    }
+    if (use_fillp) {
+        if (on)
+            c = (c >> 4) & 0xf;
+        else
+            c = c & 0xf;
+    }
+    return ds->palette[c & 0xf];
+}
+
+// Write palette entry col to screen pixel x, y (already clipped), applying
+// the 0x5f5e read/write mask like gfx_set.
+static inline void screen_pixel_write(const draw_state_t *ds, int x, int y, int col)
+{
+    uint8_t *p = ds->screen + (x >> 1) + y * 64;
+    uint8_t mask = (IS_EVEN(x) ? 0x0f : 0xf0) & ((ds->rw_mask & 0xf) * 0x11);
+    uint8_t value = ((col & 0xf) * 0x11) & ((ds->rw_mask >> 4) * 0x11);
+    *p = (*p & ~mask) | (value & mask);
+}
+
+static inline uint8_t sprite_pixel_get(const draw_state_t *ds, int x, int y)
+{
+    if (x < 0 || y < 0 || x > P8_WIDTH || y > P8_HEIGHT)
+        return 0;
+    uint8_t value = ds->sprites[(x >> 1) + y * 64];
+    return IS_EVEN(x) ? value & 0xF : value >> 4;
+}
+
 static inline void pixel_set(int x, int y, int c, int fillp, int draw_type)
 {
-    int cx, cy;
-    camera_get(&cx, &cy);
-    x -= cx;
-    y -= cy;
-    int x0, y0, x1, y1;
-    clip_get(&x0, &y0, &x1, &y1);
+    draw_state_t ds;
+    draw_state_init(&ds);
+    pixel_set_state(&ds, x, y, c, fillp, draw_type);
+}
+
+static inline void pixel_set_state(const draw_state_t *ds, int x, int y, int c, int fillp, int draw_type)
+{
+    x -= ds->camera_x;
+    y -= ds->camera_y;
 
-    if (x >= x0 && x < x1 && y >= y0 && y < y1)
+    if (x >= ds->clip_x0 && x < ds->clip_x1 && y >= ds->clip_y0 && y < ds->clip_y1)
     {
-        bool fillp_sprites, fillp_graphics_secondary, transparency;
-        if (c & 0x1000) {
-            transparency = (c & 0x100) != 0;
-            fillp_sprites = (c & 0x200) != 0;
-            fillp_graphics_secondary = (c & 0x400) != 0;
-        } else {
-            fillp = m_memory[MEMORY_FILLP] | (m_memory[MEMORY_FILLP + 1] << 8);
-            transparency = (m_memory[MEMORY_FILLP_ATTR] & 1) != 0;
-            fillp_sprites = (m_memory[MEMORY_FILLP_ATTR] & 2) != 0;
-            fillp_graphics_secondary = (m_memory[MEMORY_FILLP_ATTR] & 4) != 0;
-        }
         unsigned bit = ((3-y) & 0x3) * 4 + ((3-x) & 0x3);
-        bool on = (fillp & (1 << bit)) != 0;
-        bool use_fillp = (draw_type == DRAWTYPE_GRAPHIC) || (draw_type == DRAWTYPE_SPRITE && fillp_sprites);
-        bool use_secondary_palette = (draw_type == DRAWTYPE_SPRITE  && fillp_sprites) || (draw_type == DRAWTYPE_GRAPHIC && fillp_graphics_secondary);
-        if (!use_fillp || (use_fillp && !transparency) || !on) {
-            uint8_t col;
-            if (c == -1)
-                c = pencolor_get();
-            if (use_secondary_palette) {
-                uint8_t col_draw = color_get(PALTYPE_DRAW, (uint8_t)c);
-                uint8_t col_secondary = color_get(PALTYPE_SECONDARY, col_draw);
-                if (on)
-                    col = (col_secondary >> 4) & 0xf;
-                else
-                    col = col_secondary & 0xf;
-            } else {
-                if (use_fillp) {
-                    if (on)
-                        c = (c >> 4) & 0xf;
-                    else
-                        c = c & 0xf;
+        bool on = (pixel_fillp(ds, c, fillp) & (1 << bit)) != 0;
+        int col = pixel_color(ds, c, draw_type, on);
+        if (col >= 0)
+            screen_pixel_write(ds, x, y, col);
+    }
+}
+
+// Build the packed row patterns for colour c so that runs of pixels can be
+// written a byte (two pixels) at a time with the same result as pixel_set.
+static inline void fill_style_init(fill_style_t *style, const draw_state_t *ds, int c, int fillp, int draw_type)
+{
+    int pattern = pixel_fillp(ds, c, fillp);
+    int col_off = pixel_color(ds, c, draw_type, false);
+    int col_on = pixel_color(ds, c, draw_type, true);
+    uint8_t write_mask = (ds->rw_mask & 0xf) * 0x11;
+    uint8_t read_mask = (ds->rw_mask >> 4) * 0x11;
+
+    for (int y = 0; y < 4; y++) {
+        for (int b = 0; b < 2; b++) {
+            uint8_t value = 0;
+            uint8_t mask = 0;
+            for (int n = 0; n < 2; n++) {
+                int x = b * 2 + n;
+                unsigned bit = ((3-y) & 0x3) * 4 + ((3-x) & 0x3);
+                int col = (pattern & (1 << bit)) ? col_on : col_off;
+                if (col >= 0) {
+                    value |= (col & 0xf) << (n * 4);
+                    mask |= 0xf << (n * 4);
                 }
-                col = color_get(PALTYPE_DRAW, c);
             }
-            gfx_set(x, y, MEMORY_SCREEN, MEMORY_SCREEN_SIZE, col);
+            style->rows[y].value[b] = value & read_mask;
+            style->rows[y].mask[b] = mask & write_mask;
+        }
+    }
+    style->state = ds;
+}
+
+// Unpatterned fill with palette entry col, as written by gfx_set.
+static inline void fill_style_solid(fill_style_t *style, const draw_state_t *ds, int col)
+{
+    uint8_t value = ((col & 0xf) * 0x11) & ((ds->rw_mask >> 4) * 0x11);
+    uint8_t mask = (ds->rw_mask & 0xf) * 0x11;
+
+    for (int y = 0; y < 4; y++) {
+        for (int b = 0; b < 2; b++) {
+            style->rows[y].value[b] = value;
+            style->rows[y].mask[b] = mask;
+        }
+    }
+    style->state = ds;
+}
+
+// Plot a single pixel (draw coordinates) with a prepared style.
+static inline void fill_pixel(const fill_style_t *style, int x, int y)
+{
+    const draw_state_t *ds = style->state;
+    x -= ds->camera_x;
+    y -= ds->camera_y;
+
+    if (x < ds->clip_x0 || x >= ds->clip_x1 || y < ds->clip_y0 || y >= ds->clip_y1)
+        return;
+
+    const fill_row_t *r = &style->rows[y & 3];
+    int b = x >> 1;
+    uint8_t *p = ds->screen + b + y * 64;
+    uint8_t mask = r->mask[b & 1] & (IS_EVEN(x) ? 0x0f : 0xf0);
+    *p = (*p & ~mask) | (r->value[b & 1] & mask);
+}
+
+// Fill pixels x0..x1 of screen row y. The run must already be clipped.
+static inline void fill_span_clipped(const fill_style_t *style, int x0, int x1, int y)
+{
+    const fill_row_t *r = &style->rows[y & 3];
+    uint8_t *row = style->state->screen + y * 64;
+    int b = x0 >> 1;
+    int end = (x1 + 1) >> 1;
+
+    if (x0 & 1) {
+        uint8_t mask = r->mask[b & 1] & 0xf0;
+        row[b] = (row[b] & ~mask) | (r->value[b & 1] & mask);
+        b++;
+    }
+
+    if (r->mask[0] == 0xff && r->mask[1] == 0xff) {
+        if (r->value[0] == r->value[1]) {
+            if (end > b)
+                memset(row + b, r->value[0], end - b);
+        } else {
+            for (; b < end; b++)
+                row[b] = r->value[b & 1];
+        }
+    } else {
+        for (; b < end; b++) {
+            uint8_t mask = r->mask[b & 1];
+            row[b] = (row[b] & ~mask) | (r->value[b & 1] & mask);
         }
     }
+
+    if ((x1 & 1) == 0) {
+        b = x1 >> 1;
+        uint8_t mask = r->mask[b & 1] & 0x0f;
+        row[b] = (row[b] & ~mask) | (r->value[b & 1] & mask);
+    }
+}
+
+// Fill pixels x0..x1 of screen row y (inside the clip rectangle), limited to
+// the clip rectangle horizontally.
+static inline void fill_span(const fill_style_t *style, int x0, int x1, int y)
+{
+    const draw_state_t *ds = style->state;
+
+    x0 = MAX(x0, ds->clip_x0);
+    x1 = MIN(x1, ds->clip_x1 - 1);
+    if (x0 <= x1)
+        fill_span_clipped(style, x0, x1, y);
 }
 
-static inline void draw_scaled_sprite(int sx, int sy, int sw, int sh, int dx, int dy, float scale_x, float scale_y, bool flip_x, bool flip_y)
+// Fill the set bits of bits (bit 0 leftmost) at draw position left,y, each
+// bit covering scale_x pixels. Runs of set bits become single spans.
+static inline void fill_row_bits(const fill_style_t *style, unsigned bits, int left, int y, int scale_x)
 {
-    int dw = roundf(sw * scale_x);
-    int dh = roundf(sh * scale_y);
+    const draw_state_t *ds = style->state;
 
-    if (dw <= 0 || dh <= 0)
+    y -= ds->camera_y;
+    if (y < ds->clip_y0 || y >= ds->clip_y1)
+        return;
+
+    left -= ds->camera_x;
+    for (int x = 0; bits >> x; ) {
+        if (!((bits >> x) & 1)) {
+            x++;
+            continue;
+        }
+        int start = x;
+        while ((bits >> x) & 1)
+            x++;
+        fill_span(style, left + start * scale_x, left + x * scale_x - 1, y);
+    }
+}
+
+// Fill the rectangle x0,y0 - x1,y1 (inclusive, draw coordinates), applying
+// the camera and clipping against the clip rectangle once for all rows.
+static inline void fill_rect(const fill_style_t *style, int x0, int y0, int x1, int y1)
+{
+    const draw_state_t *ds = style->state;
+
+    x0 = MAX(x0 - ds->camera_x, ds->clip_x0);
+    y0 = MAX(y0 - ds->camera_y, ds->clip_y0);
+    x1 = MIN(x1 - ds->camera_x, ds->clip_x1 - 1);
+    y1 = MIN(y1 - ds->camera_y, ds->clip_y1 - 1);
+
+    if (x0 > x1)
+        return;
+
+    for (int y = y0; y <= y1; y++)
+        fill_span_clipped(style, x0, x1, y);
+}
+
+static inline void span_list_init(span_list_t *spans)
+{
+    for (int i = 0; i < P8_HEIGHT; i++) {
+        spans->left[i] = INT_MAX;
+        spans->right[i] = INT_MIN;
+    }
+}
+
+static inline void span_list_add(span_list_t *spans, const draw_state_t *ds, int x0, int x1, int y)
+{
+    int row = y - ds->camera_y;
+    if (x0 > x1 || row < ds->clip_y0 || row >= ds->clip_y1)
+        return;
+
+    spans->left[row] = MIN(spans->left[row], x0);
+    spans->right[row] = MAX(spans->right[row], x1);
+}
+
+static inline void span_list_add_rect(span_list_t *spans, const draw_state_t *ds, int x0, int y0, int x1, int y1)
+{
+    y0 = MAX(y0, ds->clip_y0 + ds->camera_y);
+    y1 = MIN(y1, ds->clip_y1 - 1 + ds->camera_y);
+
+    for (int y = y0; y <= y1; y++)
+        span_list_add(spans, ds, x0, x1, y);
+}
+
+static inline void span_list_add_oval_segment(span_list_t *spans, const draw_state_t *ds, int xc, int yc, int x, int y, int r, int xr, int yr, int mask)
+{
+    if (mask & 1)
+        span_list_add(spans, ds, xc, xc + x * xr / r, yc + y * yr / r);
+    if (mask & 2)
+        span_list_add(spans, ds, xc - x * xr / r, xc, yc + y * yr / r);
+    if (mask & 4)
+        span_list_add(spans, ds, xc, xc + x * xr / r, yc - y * yr / r);
+    if (mask & 8)
+        span_list_add(spans, ds, xc - x * xr / r, xc, yc - y * yr / r);
+    if (mask & 16)
+        span_list_add(spans, ds, xc, xc + y * xr / r, yc + x * yr / r);
+    if (mask & 32)
+        span_list_add(spans, ds, xc - y * xr / r, xc, yc + x * yr / r);
+    if (mask & 64)
+        span_list_add(spans, ds, xc, xc + y * xr / r, yc - x * yr / r);
+    if (mask & 128)
+        span_list_add(spans, ds, xc - y * xr / r, xc, yc - x * yr / r);
+}
+
+// Rows of a filled oval from the midpoint circle walk, scaled to xr, yr and
+// limited to the octants in mask. Every row segment starts at xc.
+static inline void span_list_add_oval(span_list_t *spans, const draw_state_t *ds, int xc, int yc, int xr, int yr, int mask)
+{
+    int r = MAX(xr, yr);
+    if (r <= 0)
+        return;
+
+    int x = 0, y = abs(r);
+    int d = 3 - 2 * abs(r);
+
+    span_list_add_oval_segment(spans, ds, xc, yc, x, y, r, xr, yr, mask);
+
+    while (y >= x)
+    {
+        x++;
+
+        if (d > 0)
+        {
+            y--;
+            d = d + 4 * (x - y) + 10;
+        }
+        else
+            d = d + 4 * x + 6;
+
+        span_list_add_oval_segment(spans, ds, xc, yc, x, y, r, xr, yr, mask);
+    }
+}
+
+static inline void fill_spans(const fill_style_t *style, const span_list_t *spans)
+{
+    const draw_state_t *ds = style->state;
+
+    for (int row = ds->clip_y0; row < ds->clip_y1; row++) {
+        if (spans->left[row] <= spans->right[row])
+            fill_span(style, spans->left[row] - ds->camera_x, spans->right[row] - ds->camera_x, row);
+    }
+}
+
+// Draw a scaled sprite. Source columns for the visible destination columns
+// are stepped once with a quotient/remainder DDA, which gives exactly
+// (x * sw) / dw without a division per pixel. Each distinct source row is
+// then packed into destination bytes once and merged into every screen row
+// it covers, so integer upscales cost a byte merge per two pixels. Returns
+// false for the cases left to the per-pixel path (see blit_sprite).
+static inline bool blit_scaled_sprite(const draw_state_t *ds, int sx, int sy, int sw, int sh, int dx, int dy, int dw, int dh, bool flip_x, bool flip_y)
+{
+    if (sw < 0 || sh < 0 || (ds->fillp_attr & 2))
+        return false;
+    // both regions span 0x2000 bytes
+    if (ds->sprites < ds->screen + MEMORY_SCREEN_SIZE && ds->screen < ds->sprites + MEMORY_SCREEN_SIZE)
+        return false;
+
+    int x = dx - ds->camera_x;
+    int y = dy - ds->camera_y;
+    int x0 = MAX(x, ds->clip_x0);
+    int y0 = MAX(y, ds->clip_y0);
+    int x1 = (int)MIN((int64_t)x + dw, ds->clip_x1);
+    int y1 = (int)MIN((int64_t)y + dh, ds->clip_y1);
+
+    if (x0 >= x1 || y0 >= y1)
+        return true;
+
+    const sprite_table_t *table = sprite_table_get(ds);
+
+    int src_cols[P8_WIDTH];
+    int64_t start = (int64_t)(x0 - x) * sw;
+    int pos = start / dw;
+    int rem = start % dw;
+    int step = sw / dw;
+    int frac = sw % dw;
+
+    for (int i = x0; i < x1; i++) {
+        src_cols[i] = sx + (flip_x ? sw - 1 - pos : pos);
+        pos += step;
+        rem += frac;
+        if (rem >= dw) {
+            rem -= dw;
+            pos++;
+        }
+    }
+
+    uint8_t value[P8_WIDTH / 2];
+    uint8_t mask[P8_WIDTH / 2];
+    int b0 = x0 >> 1;
+    int b1 = (x1 - 1) >> 1;
+    bool packed = false;
+    int packed_y = 0;
+
+    start = (int64_t)(y0 - y) * sh;
+    pos = start / dh;
+    rem = start % dh;
+    step = sh / dh;
+    frac = sh % dh;
+
+    for (int row = y0; row < y1; row++)
+    {
+        int src_y = sy + (flip_y ? sh - 1 - pos : pos);
+
+        if (!packed || src_y != packed_y) {
+            memset(value + b0, 0, b1 - b0 + 1);
+            memset(mask + b0, 0, b1 - b0 + 1);
+            for (int i = x0; i < x1; i++) {
+                uint8_t index = sprite_pixel_get(ds, src_cols[i], src_y);
+                int shift = (i & 1) * 4;
+                value[i >> 1] |= (table->value[index] & 0xf) << shift;
+                mask[i >> 1] |= (table->mask[index] & 0xf) << shift;
+            }
+            packed = true;
+            packed_y = src_y;
+        }
+
+        uint8_t *dst = ds->screen + row * 64;
+        for (int b = b0; b <= b1; b++)
+            dst[b] = (dst[b] & ~mask[b]) | (value[b] & mask[b]);
+
+        pos += step;
+        rem += frac;
+        if (rem >= dh) {
+            rem -= dh;
+            pos++;
+        }
+    }
+
+    return true;
+}
+
+static inline void draw_scaled_sprite(int sx, int sy, int sw, int sh, int dx, int dy, int dw, int dh, bool flip_x, bool flip_y)
+{
+    if (sw == 0 || sh == 0 || dw <= 0 || dh <= 0)
+        return;
+
+    draw_state_t ds;
+    draw_state_init(&ds);
+
+    if (blit_scaled_sprite(&ds, sx, sy, sw, sh, dx, dy, dw, dh, flip_x, flip_y))
         return;
 
     for (int y = 0; y < dh; y++)
@@ -404,17 +893,123 @@ static inline void draw_scaled_sprite(int sx, int sy, int sw, int sh, int dx, in
         {
             int src_x = sx + (flip_x ? (sw - 1 - (x * sw) / dw) : (x * sw) / dw);
             int src_y = sy + (flip_y ? (sh - 1 - (y * sh) / dh) : (y * sh) / dh);
-            uint8_t index = gfx_get(src_x, src_y, MEMORY_SPRITES, MEMORY_SPRITES_SIZE);
-            uint8_t color = color_get(PALTYPE_DRAW, (int)index);
+            uint8_t index = sprite_pixel_get(&ds, src_x, src_y);
+            uint8_t color = ds.palette[index];
 
             if ((color & 0xf0) == 0)
-                pixel_set(dx + x, dy + y, index, 0, DRAWTYPE_SPRITE);
+                pixel_set_state(&ds, dx + x, dy + y, index, 0, DRAWTYPE_SPRITE);
         }
     }
 }
 
-static inline void draw_sprite(int n, int left, int top, bool flip_x, bool flip_y)
+// Source byte (two sprite pixels) to palette-mapped output byte and mask of
+// opaque pixels, with the 0x5f5e read/write mask applied. Rebuilt only when
+// the draw palette or the mask changes.
+static inline const sprite_table_t *sprite_table_get(const draw_state_t *ds)
 {
+    static sprite_table_t table;
+    static uint8_t key[17];
+    static bool valid = false;
+
+    if (valid && memcmp(key, ds->palette, 16) == 0 && key[16] == ds->rw_mask)
+        return &table;
+
+    uint8_t write_mask = (ds->rw_mask & 0xf) * 0x11;
+    uint8_t read_mask = (ds->rw_mask >> 4) * 0x11;
+
+    for (int i = 0; i < 256; i++) {
+        uint8_t lo = ds->palette[i & 0xf];
+        uint8_t hi = ds->palette[i >> 4];
+        uint8_t value = (lo & 0xf) | ((hi & 0xf) << 4);
+        uint8_t mask = ((lo & 0xf0) == 0 ? 0x0f : 0) | ((hi & 0xf0) == 0 ? 0xf0 : 0);
+        table.value[i] = value & read_mask;
+        table.mask[i] = mask & write_mask;
+    }
+
+    memcpy(key, ds->palette, 16);
+    key[16] = ds->rw_mask;
+    valid = true;
+    return &table;
+}
+
+// Draw sprite n a row (four source bytes) at a time, clipping once per
+// sprite. Returns false if the sprite has to be drawn per pixel instead:
+// when it lies outside the sprite sheet (spr with w/h past sprite 255),
+// when sprite fill patterns are enabled, or when the sprite sheet and the
+// screen overlap so that reads would see earlier writes.
+static inline bool blit_sprite(const draw_state_t *ds, int n, int left, int top, bool flip_x, bool flip_y)
+{
+    if (n < 0 || n > 255 || (ds->fillp_attr & 2))
+        return false;
+    // both regions span 0x2000 bytes
+    if (ds->sprites < ds->screen + MEMORY_SCREEN_SIZE && ds->screen < ds->sprites + MEMORY_SCREEN_SIZE)
+        return false;
+
+    int x = left - ds->camera_x;
+    int y = top - ds->camera_y;
+    int y0 = MAX(y, ds->clip_y0);
+    int y1 = MIN(y + SPRITE_HEIGHT, ds->clip_y1);
+
+    if (y0 >= y1 || x + SPRITE_WIDTH <= ds->clip_x0 || x >= ds->clip_x1)
+        return true;
+
+    const sprite_table_t *table = sprite_table_get(ds);
+    int base = x >> 1;
+    int shift = (x & 1) * 4;
+
+    // nibbles of the (up to) five destination bytes inside the clip rect
+    uint64_t clip_mask = ~(uint64_t)0;
+    if (x < ds->clip_x0 || x + SPRITE_WIDTH > ds->clip_x1) {
+        clip_mask = 0;
+        for (int i = 0; i < 10; i++) {
+            int px = base * 2 + i;
+            if (px >= ds->clip_x0 && px < ds->clip_x1)
+                clip_mask |= (uint64_t)0xf << (i * 4);
+        }
+    }
+
+    const uint8_t *src = ds->sprites + (n >> 4) * SPRITE_HEIGHT * 64 + (n & 0xf) * (SPRITE_WIDTH / 2);
+
+    for (int row = y0; row < y1; row++)
+    {
+        int sy = flip_y ? (SPRITE_HEIGHT - 1 - (row - y)) : (row - y);
+        const uint8_t *s = src + sy * 64;
+        uint32_t value = 0;
+        uint32_t mask = 0;
+
+        if (flip_x) {
+            for (int i = 0; i < 4; i++) {
+                uint8_t b = s[3 - i];
+                b = (b >> 4) | (b << 4);
+                value |= (uint32_t)table->value[b] << (i * 8);
+                mask |= (uint32_t)table->mask[b] << (i * 8);
+            }
+        } else {
+            for (int i = 0; i < 4; i++) {
+                value |= (uint32_t)table->value[s[i]] << (i * 8);
+                mask |= (uint32_t)table->mask[s[i]] << (i * 8);
+            }
+        }
+
+        uint64_t v = (uint64_t)value << shift;
+        uint64_t m = ((uint64_t)mask << shift) & clip_mask;
+        uint8_t *dst = ds->screen + row * 64;
+
+        for (int i = 0; m != 0; i++, v >>= 8, m >>= 8) {
+            uint8_t bm = m & 0xff;
+            if (bm)
+                dst[base + i] = (dst[base + i] & ~bm) | (v & bm);
+        }
+    }
+
+    return true;
+}
+
+static inline void draw_sprite(const draw_state_t *ds, int n, int left, int top, bool flip_x, bool flip_y)
+{
+    if (blit_sprite(ds, n, left, top, flip_x, flip_y))
+        return;
+
     int sx = (n & 0xF) * SPRITE_WIDTH;
     int sy = (n >> 4) * SPRITE_HEIGHT;
 
@@ -424,17 +1019,20 @@ static inline void draw_sprite(int n, int left, int top, bool flip_x, bool flip_
         {
             int fx = flip_x ? (SPRITE_WIDTH - x - 1) : x;
             int fy = flip_y ? (SPRITE_HEIGHT - y - 1) : y;
-            uint8_t index = gfx_get(sx + x, sy + y, MEMORY_SPRITES, MEMORY_SPRITES_SIZE);
-            uint8_t color = color_get(PALTYPE_DRAW, index);
+            uint8_t index = sprite_pixel_get(ds, sx + x, sy + y);
+            uint8_t color = ds->palette[index];
 
             if ((color & 0xf0) == 0)
-                pixel_set(left + fx, top + fy, index, 0, DRAWTYPE_SPRITE);
+                pixel_set_state(ds, left + fx, top + fy, index, 0, DRAWTYPE_SPRITE);
         }
     }
 }
 
 static inline void draw_sprites(int n, int x, int y, int w, int h, bool flip_x, bool flip_y)
 {
+    draw_state_t ds;
+    draw_state_init(&ds);
+
     for (int sy = 0; sy < h; sy++)
     {
         for (int sx = 0; sx < w; sx++)
@@ -442,25 +1040,49 @@ static inline void draw_sprites(int n, int x, int y, int w, int h, bool flip_x,
             int index = (n == -1 ? 0 : n) + sx + sy * 16;
             int left = x + (flip_x ? (w - 1 - sx) : sx) * 8;
             int top = y + (flip_y ? (h - 1 - sy) : sy) * 8;
-            draw_sprite(index, left, top, flip_x, flip_y);
+            draw_sprite(&ds, index, left, top, flip_x, flip_y);
+        }
+    }
+}
+
+// Row y of glyph n in the built-in font as a bitmask (bit 0 is the leftmost
+// pixel). Rows past 7 run into the glyph below, as on the font sheet. The
+// sheet is converted to one bit per pixel on first use.
+static inline uint8_t font_sheet_row(int n, int y)
+{
+    static uint8_t sheet[128][16];
+    static bool valid = false;
+
+    if (!valid) {
+        for (int row = 0; row < 128; row++) {
+            for (int col = 0; col < 16; col++) {
+                uint8_t bits = 0;
+                for (int x = 0; x < 8; x++) {
+                    uint8_t b = font_map[(col * 8 + x) / 2 + row * 64];
+                    if ((IS_EVEN(x) ? b & 0xf : b >> 4) == 7)
+                        bits |= 1 << x;
+                }
+                sheet[row][col] = bits;
+            }
         }
+        valid = true;
     }
+
+    int row = (n / 16) * 8 + y;
+    if (n < 0 || y < 0 || row >= 128)
+        return 0;
+    return sheet[row][n % 16];
 }
 
 static inline void draw_char(int n, int left, int top, int col)
 {
-    int sx = n % 16 * 8;
-    int sy = n / 16 * 8;
+    draw_state_t ds;
+    fill_style_t style;
+    draw_state_init(&ds);
+    fill_style_init(&style, &ds, col, 0, DRAWTYPE_DEFAULT);
 
     for (int y = 0; y < 8; y++)
-    {
-        for (int x = 0; x < 8; x++)
-        {
-            uint8_t index = gfx_addr_get(sx + x, sy + y, (uint8_t *)font_map, 0, sizeof(font_map));
-            if (index == 7)
-                pixel_set(left + x, top + y, col, 0, DRAWTYPE_DEFAULT);
-        }
-    }
+        fill_row_bits(&style, font_sheet_row(n, y), left, top + y, 1);
 }
 
 static inline int get_p8_symbol(const char *str, int str_len, uint8_t *symbol_length)
@@ -598,6 +1220,14 @@ static inline void clip_get(int *x0, int *y0, int *x1, int *y1)
     *y1 = m_memory[MEMORY_CLIPRECT + 3];
 }
 
+// Clip rectangle limited to the screen (x1/y1 exclusive).
+static inline void clip_get_screen(int *x0, int *y0, int *x1, int *y1)
+{
+    clip_get(x0, y0, x1, y1);
+    *x1 = MIN(*x1, P8_WIDTH);
+    *y1 = MIN(*y1, P8_HEIGHT);
+}
+
 static inline void cursor_set(int x, int y, int col)
 {
     m_memory[MEMORY_CURSOR] = x;
@@ -613,22 +1243,25 @@ static inline void cursor_get(int *x, int *y)
     *y = (int)m_memory[MEMORY_CURSOR + 1];
 }
 
-static inline int map_cell_addr(int celx, int cely)
+// Address of map cell (0, cely) after resolving 0x5f56/0x5f57 and the
+// split between the upper and lower halves of the default map, or -1 if
+// row cely is not mapped. Cells of a row follow at consecutive addresses.
+static inline int map_row_addr(int cely)
 {
-    if (celx < 0 || cely < 0)
-        return 0;
+    if (cely < 0)
+        return -1;
 
     uint8_t map_start = m_memory[MEMORY_MAP_START];
     if ((map_start >= 0x10 && map_start < 0x20) ||
         (map_start >= 0x30 && map_start < 0x3f))
-        return 0;
+        return -1;
     if (map_start < 0x10 ||
         (map_start >= 0x40 && map_start < 0x80))
         map_start = 0x20;
     if (map_start < 0x80) {
         int start_offset = m_memory[MEMORY_MAP_START] & 0x0f;
         if (cely >= 32 && cely + start_offset >= 64)
-            return 0;
+            return -1;
     }
     if (cely >= 32 && map_start < 0x80) {
         map_start = 0x10;
@@ -639,12 +1272,26 @@ static inline int map_cell_addr(int celx, int cely)
     if (map_width == 0)
         map_width = 256;
 
-    int map_base = map_start << 8;
-    int offset = celx + cely * map_width;
-    int address = map_base + offset;
+    return (map_start << 8) + cely * map_width;
+}
+
+static inline bool map_addr_valid(int address)
+{
+    return address >= 0x1000 && address < 0x10000 &&
+        !(address >= 0x3000 && address < 0x8000);
+}
+
+static inline int map_cell_addr(int celx, int cely)
+{
+    if (celx < 0)
+        return 0;
+
+    int row = map_row_addr(cely);
+    if (row < 0)
+        return 0;
 
-    if (address < 0x1000 || address >= 0x10000 ||
-        (address >= 0x3000 && address < 0x8000))
+    int address = row + celx;
+    if (!map_addr_valid(address))
         return 0;
 
     return address;
@@ -18,6 +18,28 @@ static int overlay_clip_y0 = 0;
 static int overlay_clip_x1 = P8_WIDTH;
 static int overlay_clip_y1 = P8_HEIGHT;
 
+// Grow the overlay bounding box to cover x0,y0 - x1,y1.
+static inline void overlay_mark(int x0, int y0, int x1, int y1)
+{
+    if (x0 > x1) {
+        int tmp = x0;
+        x0 = x1;
+        x1 = tmp;
+    }
+
+    if (y0 > y1) {
+        int tmp = y0;
+        y0 = y1;
+        y1 = tmp;
+    }
+
+    if (x0 < m_overlay_x0) m_overlay_x0 = x0 < 0 ? 0 : x0;
+    if (y0 < m_overlay_y0) m_overlay_y0 = y0 < 0 ? 0 : y0;
+    if (x1 > m_overlay_x1) m_overlay_x1 = x1 >= P8_WIDTH ? P8_WIDTH - 1 : x1;
+    if (y1 > m_overlay_y1) m_overlay_y1 = y1 >= P8_HEIGHT ? P8_HEIGHT - 1 : y1;
+    m_overlay_generation++;
+}
+
 static inline void overlay_clip_set(int x, int y, int w, int h)
 {
     overlay_clip_x0 = x;
@@ -56,6 +78,8 @@ static inline void overlay_draw_hline(int x0, int x1, int y, int col)
     if (x0 < overlay_clip_x0) x0 = overlay_clip_x0;
     if (x1 >= overlay_clip_x1) x1 = overlay_clip_x1 - 1;
 
+    overlay_mark(x0, y, x1, y);
+
     uint8_t *dest = m_overlay_memory + ((x0 >> 1) + y * 64);
 
 
@@ -87,6 +111,8 @@ static inline void overlay_draw_vline(int x, int y0, int y1, int col)
     if (y0 < overlay_clip_y0) y0 = overlay_clip_y0;
     if (y1 >= overlay_clip_y1) y1 = overlay_clip_y1 - 1;
 
+    overlay_mark(x, y0, x, y1);
+
     uint8_t *dest = m_overlay_memory + (x >> 1) + y0 * 64;
 
     if ((x & 1) == 0) {
@@ -129,6 +155,8 @@ static inline void overlay_draw_rectfill(int x0, int y0, int x1, int y1, int col
     if (x1 >= overlay_clip_x1) x1 = overlay_clip_x1 - 1;
     if (y1 >= overlay_clip_y1) y1 = overlay_clip_y1 - 1;
 
+    overlay_mark(x0, y0, x1, y1);
+
     if (x0 & 1) {
         uint8_t *dest = m_overlay_memory + ((x0 >> 1) + y0 * 64);
         for (int y = y0; y <= y1; y++) {
@@ -170,6 +198,8 @@ static inline void overlay_pixel(int x, int y, int col)
     if (x < overlay_clip_x0 || y < overlay_clip_y0 || x >= overlay_clip_x1 || y >= overlay_clip_y1)
         return;
 
+    overlay_mark(x, y, x, y);
+
     uint8_t *dest = m_overlay_memory + (x >> 1) + y * 64;
     if (x & 1)
         *dest = (col << 4) | (*dest & 0xF);
@@ -212,12 +242,18 @@ static inline void overlay_draw_simple_text(const char *str, int x, int y, int c
 
 static inline void overlay_clear(void)
 {
-    memset(m_overlay_memory, OVERLAY_TRANSPARENT_COLOR, MEMORY_SCREEN_SIZE);
+    memset(m_overlay_memory, (OVERLAY_TRANSPARENT_COLOR << 4) | OVERLAY_TRANSPARENT_COLOR, MEMORY_SCREEN_SIZE);
+    m_overlay_x0 = P8_WIDTH;
+    m_overlay_y0 = P8_HEIGHT;
+    m_overlay_x1 = -1;
+    m_overlay_y1 = -1;
+    m_overlay_generation++;
 }
 
 static inline void overlay_draw_icon(const uint8_t *icon, int x, int y)
 {
     assert((x & 1) == 0);
+    overlay_mark(x, y, x + 7, y + 7);
     uint8_t *dest = m_overlay_memory + (x >> 1) + y * 64;
     for (int r=0;r<8;++r) {
         *dest++ = *icon++;
@@ -81,27 +81,18 @@ static inline bool get_custom_font_y_offset(int char_index)
     return (nibble & 0x8) != 0;
 }
 
-static inline bool get_font_pixel(int char_index, int x, int y, bool use_custom_font)
+// Row y of glyph char_index as a bitmask (bit 0 is the leftmost pixel). The
+// custom font at 0x5600 is already stored a row per byte, so it is read
+// straight from memory and picks up pokes immediately.
+static inline uint8_t get_font_row(int char_index, int y, bool use_custom_font)
 {
-    if (use_custom_font) {
-        if (char_index < 16) {
-            int sx = (char_index % 16) * 8;
-            int sy = (char_index / 16) * 8;
-            uint8_t index = gfx_addr_get(sx + x, sy + y, (uint8_t *)font_map, 0, sizeof(font_map));
-            return (index == 7);
-        }
+    if (use_custom_font && char_index >= 16) {
         int offset = MEMORY_FONT + 128 + (char_index - 16) * 8 + y;
-        if (offset < MEMORY_FONT + MEMORY_FONT_SIZE) {
-            uint8_t row = m_memory[offset];
-            return (row & (1 << x)) != 0;
-        }
-        return false;
-    } else {
-        int sx = (char_index % 16) * 8;
-        int sy = (char_index / 16) * 8;
-        uint8_t index = gfx_addr_get(sx + x, sy + y, (uint8_t *)font_map, 0, sizeof(font_map));
-        return (index == 7);
+        if (offset < MEMORY_FONT + MEMORY_FONT_SIZE)
+            return m_memory[offset];
+        return 0;
     }
+    return font_sheet_row(char_index, y);
 }
 
 static inline void draw_char_styled(int n, int left, int top, int fg, int bg, print_state_t *state)
@@ -122,63 +113,94 @@ static inline void draw_char_styled(int n, int left, int top, int fg, int bg, pr
     int scale_y = state->tall ? 2 : 1;
 
     int render_width = state->use_custom_font ? get_custom_font_char_width(n) : (n >= 0x80 ? state->char_w2 : state->char_w);
-    int render_height = state->char_h;
     if (render_width > 8) render_width = 8;
-    if (render_height > 8) render_height = 8;
+    unsigned width_mask = render_width > 0 ? (1u << render_width) - 1 : 0;
+
+    static const int outline_dx[] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    static const int outline_dy[] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+    draw_state_t ds;
+    fill_style_t fg_style, bg_style, outline_style;
+    draw_state_init(&ds);
+    fill_style_init(&fg_style, &ds, fg, 0, DRAWTYPE_DEFAULT);
+    if (bg != -1)
+        fill_style_init(&bg_style, &ds, bg, 0, DRAWTYPE_DEFAULT);
+    if (state->outline_enabled)
+        fill_style_init(&outline_style, &ds, state->outline_colour, 0, DRAWTYPE_DEFAULT);
+
+    uint8_t invert = state->invert ? 0xff : 0;
+    // the glyph (within its 8x8 cell) as seen by the outline test
+    uint8_t cell[10] = { 0 };
+    if (state->outline_enabled) {
+        for (int y = 0; y < 8; y++)
+            cell[y + 1] = get_font_row(n, y, state->use_custom_font) ^ invert;
+    }
 
-    int outline_dx[] = {-1, 0, 1, -1, 1, -1, 0, 1};
-    int outline_dy[] = {-1, -1, -1, 0, 0, 1, 1, 1};
+    int base_x = left + x_offset;
 
     for (int y = 0; y < state->char_h; y++) {
-        for (int x = 0; x < render_width; x++) {
-            bool is_fg = get_font_pixel(n, x, y, state->use_custom_font);
-
-            if (state->invert)
-                is_fg = !is_fg;
+        unsigned fg_bits = (get_font_row(n, y, state->use_custom_font) ^ invert) & width_mask;
+        unsigned bg_bits = (bg != -1) ? (~fg_bits & width_mask) : 0;
+        int base_y = top + y_offset + y * scale_y;
+
+        if (state->outline_enabled) {
+            // outlines and interiors overlap, so keep the per-pixel order
+            unsigned edge[8] = { 0 };
+            for (int nb = 0; nb < 8; nb++) {
+                if (!(state->outline_mask & (1 << nb)))
+                    continue;
+                int ny = y + outline_dy[nb];
+                unsigned row = (ny >= 0 && ny < 8) ? cell[ny + 1] : 0;
+                row = (outline_dx[nb] < 0) ? (row << 1) : (outline_dx[nb] > 0) ? (row >> 1) : row;
+                edge[nb] = fg_bits & ~row;
+            }
 
-            int colour = is_fg ? fg : bg;
-            if (colour == -1 && !is_fg) continue;
+            for (int x = 0; x < render_width; x++) {
+                bool is_fg = (fg_bits >> x) & 1;
+                if (!is_fg && !((bg_bits >> x) & 1))
+                    continue;
 
-            if (state->outline_enabled && is_fg) {
                 for (int nb = 0; nb < 8; nb++) {
-                    if (state->outline_mask & (1 << nb)) {
-                        int nx = x + outline_dx[nb];
-                        int ny = y + outline_dy[nb];
-
-                        bool neighbour_is_fg = false;
-                        if (nx >= 0 && nx < 8 && ny >= 0 && ny < 8) {
-                            neighbour_is_fg = get_font_pixel(n, nx, ny, state->use_custom_font);
-                            if (state->invert)
-                                neighbour_is_fg = !neighbour_is_fg;
+                    if (!((edge[nb] >> x) & 1))
+                        continue;
+                    for (int dy = 0; dy < scale_y; dy++) {
+                        for (int dx = 0; dx < scale_x; dx++) {
+                            if (state->stripey && !((dx + dy) & 1))
+                                continue;
+                            fill_pixel(&outline_style, base_x + x * scale_x + dx + outline_dx[nb], base_y + dy + outline_dy[nb]);
                         }
+                    }
+                }
 
-                        if (!neighbour_is_fg) {
-                            for (int dy = 0; dy < scale_y; dy++) {
-                                for (int dx = 0; dx < scale_x; dx++) {
-                                    if (state->stripey && !((dx + dy) & 1))
-                                        continue;
-                                    int px = left + x_offset + x * scale_x + dx + outline_dx[nb];
-                                    int py = top + y_offset + y * scale_y + dy + outline_dy[nb];
-                                    pixel_set(px, py, state->outline_colour, 0, DRAWTYPE_DEFAULT);
-                                }
-                            }
+                if (!state->outline_skip_interior || !is_fg) {
+                    const fill_style_t *style = is_fg ? &fg_style : &bg_style;
+                    for (int dy = 0; dy < scale_y; dy++) {
+                        for (int dx = 0; dx < scale_x; dx++) {
+                            if (state->stripey && !((dx + dy) & 1))
+                                continue;
+                            fill_pixel(style, base_x + x * scale_x + dx, base_y + dy);
                         }
                     }
                 }
             }
-
-            if (!state->outline_skip_interior || !is_fg) {
-                for (int dy = 0; dy < scale_y; dy++) {
+        } else if (state->stripey) {
+            for (int dy = 0; dy < scale_y; dy++) {
+                for (int x = 0; x < render_width; x++) {
+                    if (!(((fg_bits | bg_bits) >> x) & 1))
+                        continue;
+                    const fill_style_t *style = ((fg_bits >> x) & 1) ? &fg_style : &bg_style;
                     for (int dx = 0; dx < scale_x; dx++) {
-                        if (state->stripey && !((dx + dy) & 1))
-                            continue;
-
-                        int px = left + x_offset + x * scale_x + dx;
-                        int py = top + y_offset + y * scale_y + dy;
-                        pixel_set(px, py, colour, 0, DRAWTYPE_DEFAULT);
+                        if ((dx + dy) & 1)
+                            fill_pixel(style, base_x + x * scale_x + dx, base_y + dy);
                     }
                 }
             }
+        } else {
+            for (int dy = 0; dy < scale_y; dy++) {
+                fill_row_bits(&fg_style, fg_bits, base_x, base_y + dy, scale_x);
+                if (bg_bits)
+                    fill_row_bits(&bg_style, bg_bits, base_x, base_y + dy, scale_x);
+            }
         }
     }
 }
@@ -379,15 +401,17 @@ static inline void draw_text(const char *str, unsigned str_len, int x, int y, in
                                 bool respect_padding = (cmd == ',');
                                 int draw_x = x + (respect_padding && state.border ? 1 : 0);
                                 int draw_y = y + (respect_padding && state.border ? 1 : 0);
+                                draw_state_t ds;
+                                draw_state_init(&ds);
 
                                 for (int row = 0; row < 8 && i + 1 < str_len; row++) {
                                     uint8_t byte = str[++i];
                                     for (int bit = 0; bit < 8; bit++) {
                                         if (byte & (1 << bit)) {
-                                            pixel_set(draw_x + bit, draw_y + row, fg, 0, DRAWTYPE_DEFAULT);
+                                            pixel_set_state(&ds, draw_x + bit, draw_y + row, fg, 0, DRAWTYPE_DEFAULT);
                                         } else if (bg != -1 || state.solid_bg) {
                                             int draw_bg = state.solid_bg ? (bg != -1 ? bg : 0) : bg;
-                                            pixel_set(draw_x + bit, draw_y + row, draw_bg, 0, DRAWTYPE_DEFAULT);
+                                            pixel_set_state(&ds, draw_x + bit, draw_y + row, draw_bg, 0, DRAWTYPE_DEFAULT);
                                         }
                                     }
                                 }
@@ -400,15 +424,17 @@ static inline void draw_text(const char *str, unsigned str_len, int x, int y, in
                                 bool respect_padding = (cmd == ';');
                                 int draw_x = x + (respect_padding && state.border ? 1 : 0);
                                 int draw_y = y + (respect_padding && state.border ? 1 : 0);
+                                draw_state_t ds;
+                                draw_state_init(&ds);
 
                                 for (int row = 0; row < 8; row++) {
                                     uint8_t byte = (hexy(str[i + row*2 + 1]) << 4) | hexy(str[i + row*2 + 2]);
                                     for (int bit = 0; bit < 8; bit++) {
                                         if (byte & (1 << bit)) {
-                                            pixel_set(draw_x + bit, draw_y + row, fg, 0, DRAWTYPE_DEFAULT);
+                                            pixel_set_state(&ds, draw_x + bit, draw_y + row, fg, 0, DRAWTYPE_DEFAULT);
                                         } else if (bg != -1 || state.solid_bg) {
                                             int draw_bg = state.solid_bg ? (bg != -1 ? bg : 0) : bg;
-                                            pixel_set(draw_x + bit, draw_y + row, draw_bg, 0, DRAWTYPE_DEFAULT);
+                                            pixel_set_state(&ds, draw_x + bit, draw_y + row, draw_bg, 0, DRAWTYPE_DEFAULT);
                                         }
                                     }
                                 }
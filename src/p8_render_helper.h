@@ -0,0 +1,115 @@
+/*
+ * p8_render_helper.h
+ *
+ *  Row conversion from packed 4-bit screen bytes to 32-bit output pixels:
+ *  a scalar kernel and SSSE3/NEON kernels that must match it bit for bit.
+ *  tests/render_rows_test.c checks them, run it with "make test".
+ */
+
+#ifndef P8_RENDER_HELPER_H
+#define P8_RENDER_HELPER_H
+
+#include <stdint.h>
+#include <string.h>
+#include "p8_emu.h"
+
+// SSSE3 is picked at runtime on x86. The NEON kernel has not been checked
+// on ARM hardware yet, so AArch64 builds only use it with RENDER_USE_NEON.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RENDER_SSSE3
+#include <tmmintrin.h>
+#elif defined(__aarch64__) && defined(RENDER_USE_NEON)
+#define RENDER_NEON
+#include <arm_neon.h>
+#endif
+
+typedef struct {
+    uint32_t palette[16];
+    uint32_t pairs[256][2];
+    uint8_t planes[4][16]; // byte k of each palette entry, for the shuffle kernels
+} render_table_t;
+
+typedef void (*render_row_fn)(uint32_t *out, const uint8_t *src, const render_table_t *table);
+
+static inline void render_table_fill(render_table_t *table, const uint32_t *palette)
+{
+    memcpy(table->palette, palette, sizeof(table->palette));
+    for (int i = 0; i < 256; i++) {
+        table->pairs[i][0] = palette[i & 0xf];
+        table->pairs[i][1] = palette[i >> 4];
+    }
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; i < 16; i++)
+            table->planes[k][i] = palette[i] >> (k * 8);
+    }
+}
+
+static inline void render_row_normal(uint32_t *out, const uint8_t *src, const render_table_t *table)
+{
+    for (int b = 0; b < P8_WIDTH / 2; b++) {
+        const uint32_t *pair = table->pairs[src[b]];
+        out[b * 2] = pair[0];
+        out[b * 2 + 1] = pair[1];
+    }
+}
+
+#ifdef RENDER_SSSE3
+// Look up 16 pixel indices in the four palette byte planes and store the
+// resulting 16 ARGB pixels.
+__attribute__((target("ssse3")))
+static inline void render_lookup_ssse3(uint32_t *out, __m128i index, const __m128i *planes)
+{
+    __m128i b0 = _mm_shuffle_epi8(planes[0], index);
+    __m128i b1 = _mm_shuffle_epi8(planes[1], index);
+    __m128i b2 = _mm_shuffle_epi8(planes[2], index);
+    __m128i b3 = _mm_shuffle_epi8(planes[3], index);
+    __m128i lo01 = _mm_unpacklo_epi8(b0, b1);
+    __m128i hi01 = _mm_unpackhi_epi8(b0, b1);
+    __m128i lo23 = _mm_unpacklo_epi8(b2, b3);
+    __m128i hi23 = _mm_unpackhi_epi8(b2, b3);
+
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(lo01, lo23));
+    _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi16(lo01, lo23));
+    _mm_storeu_si128((__m128i *)(out + 8), _mm_unpacklo_epi16(hi01, hi23));
+    _mm_storeu_si128((__m128i *)(out + 12), _mm_unpackhi_epi16(hi01, hi23));
+}
+
+__attribute__((target("ssse3")))
+static inline void render_row_normal_ssse3(uint32_t *out, const uint8_t *src, const render_table_t *table)
+{
+    const __m128i nibble = _mm_set1_epi8(0xf);
+    __m128i planes[4];
+    for (int k = 0; k < 4; k++)
+        planes[k] = _mm_loadu_si128((const __m128i *)table->planes[k]);
+
+    for (int b = 0; b < P8_WIDTH / 2; b += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + b));
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        render_lookup_ssse3(out + b * 2, _mm_unpacklo_epi8(lo, hi), planes);
+        render_lookup_ssse3(out + b * 2 + 16, _mm_unpackhi_epi8(lo, hi), planes);
+    }
+}
+#endif
+
+#ifdef RENDER_NEON
+static inline void render_row_normal_neon(uint32_t *out, const uint8_t *src, const render_table_t *table)
+{
+    uint8x16_t planes[4];
+    for (int k = 0; k < 4; k++)
+        planes[k] = vld1q_u8(table->planes[k]);
+
+    for (int b = 0; b < P8_WIDTH / 2; b += 16) {
+        uint8x16_t v = vld1q_u8(src + b);
+        uint8x16x2_t index = vzipq_u8(vandq_u8(v, vdupq_n_u8(0xf)), vshrq_n_u8(v, 4));
+        for (int half = 0; half < 2; half++) {
+            uint8x16x4_t argb;
+            for (int k = 0; k < 4; k++)
+                argb.val[k] = vqtbl1q_u8(planes[k], index.val[half]);
+            vst4q_u8((uint8_t *)(out + b * 2 + half * 16), argb);
+        }
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * render_rows_test.c
+ *
+ *  Checks the vector row kernels in p8_render_helper.h against the scalar
+ *  render_row_normal on every screen byte value under several palettes.
+ *  Built and run by "make test", exits non-zero on any mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "p8_render_helper.h"
+
+#define PALETTE_COUNT 5
+
+static void make_palette(int p, uint32_t *palette)
+{
+    uint32_t seed = 0x1234567 + p;
+    for (int i = 0; i < 16; i++) {
+        switch (p) {
+        case 0: palette[i] = 0x01010101u * i + 0x00102030u; break; // distinct bytes
+        case 1: palette[i] = 0xff000000u | (i * 0x111111u); break; // equal rgb bytes
+        case 2: palette[i] = 0xffffffffu - i; break;              // near all-ones
+        case 3: palette[i] = 0x00000000u; break;                  // all zero
+        default: seed = seed * 1103515245u + 12345u; palette[i] = seed; break;
+        }
+    }
+}
+
+static int check_kernel(const char *name, render_row_fn kernel)
+{
+    uint8_t src[256];
+    for (int i = 0; i < 256; i++)
+        src[i] = i;
+
+    int failures = 0;
+    for (int p = 0; p < PALETTE_COUNT; p++) {
+        uint32_t palette[16];
+        render_table_t table;
+        make_palette(p, palette);
+        render_table_fill(&table, palette);
+
+        // 256 byte values are four screen rows of P8_WIDTH / 2 bytes
+        for (int row = 0; row < 256; row += P8_WIDTH / 2) {
+            uint32_t expected[P8_WIDTH], actual[P8_WIDTH];
+            render_row_normal(expected, src + row, &table);
+            kernel(actual, src + row, &table);
+            if (memcmp(expected, actual, sizeof(expected)) != 0) {
+                printf("%s: palette %d, bytes %d-%d differ from the scalar path\n",
+                       name, p, row, row + P8_WIDTH / 2 - 1);
+                failures++;
+            }
+        }
+    }
+
+    printf("%s: %s\n", name, failures ? "FAIL" : "ok");
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    int checked = 0;
+
+#ifdef RENDER_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        failures += check_kernel("ssse3", render_row_normal_ssse3);
+        checked++;
+    } else {
+        printf("ssse3: not supported by this CPU, skipped\n");
+    }
+#endif
+#ifdef RENDER_NEON
+    failures += check_kernel("neon", render_row_normal_neon);
+    checked++;
+#endif
+
+    if (!checked)
+        printf("no vector row kernel in this build\n");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}